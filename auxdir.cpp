@@ -0,0 +1,233 @@
+#include "auxdir.h"
+#include "fileutil.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+static const char *lock_name = ".texbuild.lock"; // in each directory, its mtime is when the directory was last used
+static const char *evicted_name = ".evicted";    // in aux_root, its mtime is when the directories were last added up
+static const int evict_interval = 10;           // seconds, so a batch doesn't walk every directory after every build
+
+// one document's directory, as eviction sees it
+struct aux_dir
+{
+    std::string path;
+    time_t used;
+    uint64_t size;
+};
+
+int claim_aux_dir(const build_job &job)
+{
+    std::string path = join_path(job.outdir, lock_name);
+
+    // eviction takes the lock exclusively before removing a directory, so holding it shared keeps the directory
+    // around. one removed while we waited for the lock has taken the lock file with it, so start again
+    for(int attempt = 0; attempt < 3; attempt++)
+    {
+        if(!make_directories(job.outdir))
+            return -1;
+
+        int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        struct stat st;
+
+        if(fd < 0)
+            return -1;
+        if(flock(fd, LOCK_SH) == 0 && fstat(fd, &st) == 0 && st.st_nlink > 0)
+        {
+            futimens(fd, NULL); // the most recently used now
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+void release_aux_dir(int fd)
+{
+    if(fd >= 0)
+        close(fd); // releases the lock too
+}
+
+static bool same_contents(const std::string &a, const std::string &b)
+{
+    struct stat sta, stb;
+    uint64_t ha, hb;
+
+    if(stat(a.c_str(), &sta) != 0 || stat(b.c_str(), &stb) != 0 || sta.st_size != stb.st_size)
+        return false;
+    return hash_file(a, ha) && hash_file(b, hb) && ha == hb;
+}
+
+static bool copy_file(const std::string &from, const std::string &to)
+{
+    // the source directory is usually on another filesystem, so a copy next to the old file then a rename over it,
+    // which a viewer watching the file sees as a single change
+    std::string tmp = to + ".texbuild-tmp";
+    FILE *in = fopen(from.c_str(), "rb");
+
+    if(!in)
+        return false;
+
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if(!out)
+    {
+        fclose(in);
+        return false;
+    }
+
+    char buffer[65536];
+    size_t n;
+    bool ok = true;
+
+    while(ok && (n = fread(buffer, 1, sizeof buffer, in)) > 0)
+        ok = fwrite(buffer, 1, n, out) == n;
+
+    ok = ok && !ferror(in);
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+
+    if(ok && rename(tmp.c_str(), to.c_str()) == 0)
+        return true;
+
+    remove(tmp.c_str());
+    return false;
+}
+
+bool publish_output(const build_job &job)
+{
+    if(job.publishdir == "" || job.outext == "")
+        return true;
+
+    if(!make_directories(job.publishdir))
+    {
+        std::cout << "\nError: could not create '" << job.publishdir << "' to copy the output to\n" << std::endl;
+        return false;
+    }
+
+    // the .synctex.gz goes with it, or the viewer can't find its way back to the source
+    for(const std::string &ext:{job.outext, std::string(".synctex.gz")})
+    {
+        std::string from = join_path(job.outdir, job.jobname + ext), to = join_path(job.publishdir, job.jobname + ext);
+
+        if(!file_exists(from))
+        {
+            if(ext == job.outext)
+                std::cout << "Warning: there is no '" << from << "' to copy to '" << job.publishdir << "'" << std::endl;
+            continue;
+        }
+        if(same_contents(from, to))
+            continue; // left alone, so the viewer doesn't reload for nothing
+
+        if(!copy_file(from, to))
+        {
+            std::cout << "\nError: could not copy '" << from << "' to '" << to << "'\n" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t walked_size;
+
+static int add_size(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    if(type == FTW_F)
+        walked_size += (uint64_t)st->st_blocks * 512; // what it takes up, which is what counts on tmpfs
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    if(type == FTW_DP)
+        rmdir(path);
+    else
+        unlink(path);
+    return 0;
+}
+
+void evict_aux_dirs()
+{
+    std::string stamp = join_path(aux_root, evicted_name);
+    time_t now = time(NULL);
+    struct stat st;
+
+    if(stat(stamp.c_str(), &st) == 0 && st.st_mtime <= now && now - st.st_mtime < evict_interval)
+        return;
+
+    int stampfd = open(stamp.c_str(), O_WRONLY | O_CREAT, 0644);
+    if(stampfd >= 0)
+    {
+        futimens(stampfd, NULL);
+        close(stampfd);
+    }
+
+    std::vector<aux_dir> dirs;
+    uint64_t total = 0, limit = (uint64_t)aux_root_limit_mb * 1024 * 1024, hash;
+
+    DIR *d = opendir(aux_root.c_str());
+    if(!d)
+        return;
+
+    struct dirent *entry;
+    while((entry = readdir(d)) != NULL)
+    {
+        // only the directories claim_aux_dir makes, named after the master's hash
+        if(!parse_hex64(entry->d_name, hash))
+            continue;
+
+        aux_dir dir = {join_path(aux_root, entry->d_name), 0, 0};
+
+        if(stat(join_path(dir.path, lock_name).c_str(), &st) == 0 || stat(dir.path.c_str(), &st) == 0)
+            dir.used = st.st_mtime;
+
+        walked_size = 0;
+        nftw(dir.path.c_str(), add_size, 16, FTW_PHYS);
+        dir.size = walked_size;
+
+        total += dir.size;
+        dirs.push_back(dir);
+    }
+    closedir(d);
+
+    if(total <= limit)
+        return;
+
+    std::sort(dirs.begin(), dirs.end(), [](const aux_dir &a, const aux_dir &b) { return a.used < b.used; });
+
+    for(auto &dir:dirs)
+    {
+        if(total <= limit)
+            break;
+
+        int fd = open(join_path(dir.path, lock_name).c_str(), O_RDWR | O_CREAT, 0644);
+
+        if(fd < 0)
+            continue;
+        if(flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            close(fd); // being built right now
+            continue;
+        }
+
+        nftw(dir.path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        close(fd);
+
+        total -= dir.size;
+        std::cout << "Removed the least recently used intermediate files in '" << dir.path << "' (" << dir.size / 1024
+                  << " kB), to keep under the --auxdir limit of " << aux_root_limit_mb << " MB" << std::endl;
+    }
+}
+
+#endif
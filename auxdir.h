@@ -0,0 +1,25 @@
+#ifndef AUXDIR_H
+#define AUXDIR_H
+
+#include "texbuild.h"
+
+#include <string>
+
+#ifdef SYSTEM_IS_LINUX
+// --auxdir: every master's intermediate files live in aux_root/<hash of the master path>, on tmpfs by default, and
+// are kept between runs. only the output is copied back to the source (or --outdir) directory. once the directories
+// add up to more than aux_root_limit_mb the least recently used go
+
+// marks the job's directory as in use, so it can't be evicted from under the build
+// returns a descriptor to give to release_aux_dir, or -1 if the directory couldn't be claimed
+int claim_aux_dir(const build_job &job);
+void release_aux_dir(int fd);
+
+// copies the output and its .synctex.gz to job.publishdir, each replacing the old one in a single rename
+bool publish_output(const build_job &job);
+
+// removes the least recently used directories not in use until the rest fit under the limit
+void evict_aux_dirs();
+#endif
+
+#endif
@@ -0,0 +1,266 @@
+#include "batch.h"
+#include "masterindex.h"
+#include "metrics.h"
+#include "fileutil.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <map>
+#include <set>
+
+#include <glob.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// what a batch child exits with, so the parent knows how it went without sharing any memory
+static const int child_built = 0, child_failed = 1, child_up_to_date = 2;
+
+struct batch_entry
+{
+    build_job job;
+    std::string log; // everything the build printed goes here rather than the terminal
+    std::chrono::steady_clock::time_point start;
+    double expected; // ms the last build took, < 0 if there isn't one
+};
+
+static bool is_directory(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void add_path(const std::string &path, std::vector<std::string> &files)
+{
+    if(is_directory(path))
+    {
+        std::vector<std::string> found;
+        list_files(path, ".tex", found);
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    else
+        files.push_back(path);
+}
+
+std::vector<std::string> expand_batch_paths(const std::vector<std::string> &paths)
+{
+    std::vector<std::string> files, result;
+    std::set<std::string> seen;
+
+    for(auto path:paths)
+    {
+        sanitise_path(path);
+
+        if(path.find_first_of("*?[") != std::string::npos)
+        {
+            // the shell didn't expand it (it was quoted), so do it here
+            glob_t matches;
+            if(glob(path.c_str(), 0, NULL, &matches) == 0)
+            {
+                for(size_t i = 0; i < matches.gl_pathc; i++)
+                    add_path(matches.gl_pathv[i], files);
+            }
+            else
+                std::cout << "Warning: nothing matches '" << path << "'" << std::endl;
+            globfree(&matches);
+        }
+        else
+            add_path(path, files);
+    }
+
+    for(auto &file:files)
+    {
+        std::string abspath = absolute_path(file);
+
+        if(seen.insert(abspath).second)
+            result.push_back(abspath);
+    }
+    return result;
+}
+
+static pid_t start_build(batch_entry &entry)
+{
+    make_directories(entry.job.outdir);
+    entry.log = join_path(entry.job.outdir, entry.job.jobname + ".texbuild.log");
+    entry.start = std::chrono::steady_clock::now();
+
+    std::cout.flush(); // otherwise the child prints whatever is still buffered a second time
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        int fd = open(entry.log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        std::cout << "This is TeXbuild v" << version << ", building '" << entry.job.texpath << "'\n" << std::endl;
+
+        bool skipped;
+        int rc = compile_document(entry.job, &skipped);
+
+        std::cout.flush();
+        _exit(rc != 0 ? child_failed : skipped ? child_up_to_date : child_built);
+    }
+    return pid;
+}
+
+std::vector<build_job> resolve_masters(const std::vector<std::string> &files)
+{
+    std::vector<build_job> jobs;
+    std::set<std::string> masters;
+
+    for(auto &path:files)
+    {
+        build_job job;
+        size_t slashpos = path.find_last_of('/');
+        std::streambuf *coutbuf = std::cout.rdbuf();
+
+        // parse_file's commentary for hundreds of files isn't much use to anyone
+        std::cout.rdbuf(NULL);
+        resolve_job(path.substr(0, slashpos + 1), path.substr(slashpos + 1), job);
+        std::cout.rdbuf(coutbuf);
+
+        if(job.compcall == "")
+        {
+            std::cout << "  " << path << " has no engine, skipping" << std::endl;
+            continue;
+        }
+        if(!masters.insert(job.texpath).second)
+            continue; // another file already led to this master
+
+        if(job.texpath != path)
+            std::cout << "  " << path << " -> " << job.texpath << std::endl;
+        jobs.push_back(job);
+    }
+    save_master_index(); // once for the lot, not once per file
+    return jobs;
+}
+
+int run_batch(const std::vector<std::string> &paths, int jobs)
+{
+    std::vector<std::string> files = expand_batch_paths(paths);
+    std::vector<batch_entry> entries;
+
+    if(jobs <= 0)
+        jobs = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+
+    std::cout << "Resolving master files for " << files.size() << (files.size() == 1 ? " file" : " files") << "..." << std::endl;
+
+    for(auto &job:resolve_masters(files))
+    {
+        batch_entry entry;
+        entry.job = job;
+        entries.push_back(entry);
+    }
+
+    if(entries.empty())
+    {
+        std::cout << "Error: nothing to build" << std::endl;
+        return 1;
+    }
+
+    // the longest builds first, so a slow one doesn't start last and hold everything up. one never built before
+    // could be the slowest of the lot, so those go first of all
+    std::map<std::string, double> durations = last_durations();
+    for(auto &entry:entries)
+        entry.expected = expected_duration(entry.job, durations);
+    std::stable_sort(entries.begin(), entries.end(), [](const batch_entry &a, const batch_entry &b)
+    {
+        return (a.expected < 0 ? 1e300 : a.expected) > (b.expected < 0 ? 1e300 : b.expected);
+    });
+
+    jobs = std::min<long>(jobs, entries.size());
+    std::cout << "\nBuilding " << entries.size() << (entries.size() == 1 ? " document" : " documents")
+              << " with " << jobs << (jobs == 1 ? " worker" : " workers") << "...\n" << std::endl;
+
+    auto batch_start = std::chrono::steady_clock::now();
+    std::map<pid_t, size_t> running; // child pid -> index into entries
+    size_t next = 0, finished = 0;
+    int built = 0, up_to_date = 0, failed = 0;
+
+    while(next < entries.size() || !running.empty())
+    {
+        while((int)running.size() < jobs && next < entries.size())
+        {
+            pid_t pid = start_build(entries[next]);
+
+            if(pid < 0)
+            {
+                std::cout << "Error: fork() failed for '" << entries[next].job.texpath << "'" << std::endl;
+                failed++;
+                finished++;
+            }
+            else
+                running[pid] = next;
+            next++;
+        }
+
+        if(running.empty())
+            continue;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if(pid < 0 && errno != EINTR)
+        {
+            // the children can't be reaped, so nothing still running or waiting to start will be accounted for
+            std::cout << "Error: waitpid() failed, giving up on the remaining documents" << std::endl;
+            failed += running.size() + (entries.size() - next);
+            break;
+        }
+        if(pid < 0 || running.find(pid) == running.end())
+            continue;
+
+        batch_entry &entry = entries[running[pid]];
+        running.erase(pid);
+        finished++;
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - entry.start).count();
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : child_failed;
+        std::string result;
+
+        if(code == child_built)
+        {
+            result = "built";
+            built++;
+        }
+        else if(code == child_up_to_date)
+        {
+            result = "up to date";
+            up_to_date++;
+        }
+        else
+        {
+            result = "FAILED";
+            failed++;
+        }
+
+        std::cout << "[" << std::setw(std::to_string(entries.size()).size()) << finished << "/" << entries.size() << "] "
+                  << std::left << std::setw(11) << result << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(7) << elapsed << "s  " << entry.job.texpath;
+        if(code != child_built && code != child_up_to_date)
+            std::cout << " (see '" << entry.log << "')";
+        std::cout << std::endl;
+    }
+
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+
+    std::cout << "\nBatch complete: " << built << " built, " << up_to_date << " up to date, " << failed << " failed in "
+              << std::fixed << std::setprecision(1) << total << "s" << std::endl;
+
+    return failed == 0 ? 0 : 1;
+}
+
+#endif
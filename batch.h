@@ -0,0 +1,18 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+
+#ifdef SYSTEM_IS_LINUX
+// builds every master reachable from the given files, directories and globs, jobs at a time (0 = one per core)
+// returns 0 if every build succeeded
+int run_batch(const std::vector<std::string> &paths, int jobs);
+
+std::vector<std::string> expand_batch_paths(const std::vector<std::string> &paths); // every .tex file the paths refer to
+std::vector<build_job> resolve_masters(const std::vector<std::string> &files); // one job per distinct master
+#endif
+
+#endif
@@ -0,0 +1,445 @@
+// texbuild benchmarks, built and run with make bench
+//
+//   bench/bench                        microbenchmarks, then end to end builds
+//   bench/bench micro                  just the microbenchmarks of the parsing helpers
+//   bench/bench e2e [path/to/texbuild] just the end to end builds of generated projects, against a stub engine
+//   bench/bench generate <dir>         write the generated project to dir and stop, for poking at by hand
+//
+// the numbers are only meant to be compared with each other, run it before and after a change on the same machine
+
+#include "texbuild.h"
+#include "specifiers.h"
+#include "fileutil.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+typedef std::chrono::steady_clock bench_clock;
+
+// each microbenchmark runs for at least this long, doubling the iterations until it has
+static const double min_seconds = 0.2;
+
+static const char *stub_engine = "texbuild-stub-engine";
+
+// what texbuild's end to end runs get to build, see generate_project
+struct project_shape
+{
+    int chain_depth;    // files in the master= chain
+    int files;          // separate masters for batch mode
+    int path_depth;     // directories above the long path document
+    int name_length;    // characters in each of those directory names
+};
+
+static const project_shape default_shape = {200, 500, 24, 48};
+
+// discards everything, but still costs the formatting like a terminal would
+struct null_buffer : std::streambuf
+{
+    int overflow(int c) { return c; }
+};
+
+static volatile size_t sink; // keeps the compiler from optimising the work away
+
+template<typename F> static void benchmark(const std::string &name, size_t items, F f)
+{
+    size_t iterations = 1;
+    double seconds = 0;
+
+    f(); // warm up
+
+    for(;;)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        for(size_t i = 0; i < iterations; i++)
+            f();
+        seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        if(seconds >= min_seconds)
+            break;
+        iterations *= 2;
+    }
+
+    double per_item = seconds / (iterations * items) * 1e9;
+    std::cout << "  " << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << per_item << " ns/item" << std::setw(12) << std::setprecision(0) << 1e9 / per_item
+              << " items/s" << std::endl;
+}
+
+static std::string random_name(std::mt19937 &rng, size_t length)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz0123456789-_";
+    std::string s;
+
+    for(size_t i = 0; i < length; i++)
+        s += letters[rng() % (sizeof letters - 1)];
+    return s;
+}
+
+static std::vector<std::string> generate_first_lines(std::mt19937 &rng, size_t count)
+{
+    // the sort of thing people put on the first line, in any order, with stray spaces
+    static const char *pairs[] = {
+        "engine=pdflatex", "engine = xelatex", "bib=biber", "bib = bibtex", "options=-shell-escape --synctex=1",
+        "biboptions=--quiet", "outext=.pdf", "openwith=\"/opt/my viewer/bin/viewer\"", "outoptions=--unique",
+        "maxpasses=4", "master=../../thesis/main.tex", "master=none"
+    };
+    std::vector<std::string> lines;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        std::string line = "%";
+        size_t n = 1 + rng() % 8;
+
+        for(size_t j = 0; j < n; j++)
+            line += std::string(rng() % 3 == 0 ? " " : "") + pairs[rng() % (sizeof pairs / sizeof pairs[0])] + ";";
+        if(rng() % 4 == 0)
+            line += "\r"; // saved on windows
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static std::vector<std::string> generate_windows_paths(std::mt19937 &rng, size_t count)
+{
+    std::vector<std::string> paths;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        std::string path = "C:\\Users\\someone\\Documents";
+        size_t depth = 5 + rng() % 25;
+
+        for(size_t j = 0; j < depth; j++)
+            path += (rng() % 5 == 0 ? "\\\\" : "\\") + random_name(rng, 4 + rng() % 20);
+        paths.push_back(path + "\\main.tex");
+    }
+    return paths;
+}
+
+static std::vector<std::pair<std::string, std::string> > generate_relative_paths(std::mt19937 &rng, size_t count)
+{
+    // an absolute directory and a master= path climbing some way out of it
+    std::vector<std::pair<std::string, std::string> > paths;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        std::string dir = "/";
+        size_t depth = 4 + rng() % 40, up = rng() % depth;
+
+        for(size_t j = 0; j < depth; j++)
+            dir += random_name(rng, 3 + rng() % 12) + "/";
+
+        std::string rel;
+        for(size_t j = 0; j < up; j++)
+            rel += "../";
+        paths.push_back(std::make_pair(dir, rel + "chapters/" + random_name(rng, 8) + ".tex"));
+    }
+    return paths;
+}
+
+static int run_microbenchmarks()
+{
+    std::mt19937 rng(42); // the same inputs every time
+    std::vector<std::string> lines = generate_first_lines(rng, 1000);
+    std::vector<std::string> paths = generate_windows_paths(rng, 1000);
+    std::vector<std::pair<std::string, std::string> > relative = generate_relative_paths(rng, 1000);
+
+    // the first lines again, each in a file of its own, for read_first_line
+    char dir_template[] = "/tmp/texbuild-bench-XXXXXX";
+    if(mkdtemp(dir_template) == NULL)
+    {
+        std::cout << "Error: could not create a temporary directory" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    for(size_t i = 0; i < lines.size(); i++)
+    {
+        files.push_back(join_path(dir_template, std::to_string(i) + ".tex"));
+        std::ofstream(files.back()) << lines[i] << "\n\\documentclass{article}\n";
+    }
+
+    std::cout << "Microbenchmarks, over 1000 generated inputs each\n" << std::endl;
+
+    benchmark("explode (first lines on ;)", lines.size(), [&]()
+    {
+        for(auto &line:lines)
+            sink += explode(line, ';').size();
+    });
+
+    benchmark("explode (paths on \\)", paths.size(), [&]()
+    {
+        for(auto &path:paths)
+            sink += explode(path, '\\').size();
+    });
+
+    benchmark("trim_whitespace", lines.size(), [&]()
+    {
+        for(auto &line:lines)
+            sink += trim_whitespace(line).size();
+    });
+
+    size_t unread = 0;
+    benchmark("read_first_line", files.size(), [&]()
+    {
+        std::string line;
+        for(auto &file:files)
+        {
+            if(!read_first_line(file, line))
+                unread++;
+            sink += line.size();
+        }
+    });
+
+    for(auto &file:files)
+        remove(file.c_str());
+    rmdir(dir_template);
+
+    if(unread > 0)
+    {
+        std::cout << "Error: read_first_line couldn't read the files it was given, its time means nothing" << std::endl;
+        return 1;
+    }
+
+    benchmark("sanitise_path", paths.size(), [&]()
+    {
+        for(auto &path:paths)
+        {
+            std::string s = path;
+            sanitise_path(s);
+            sink += s.size();
+        }
+    });
+
+    benchmark("mod_abs_path", relative.size(), [&]()
+    {
+        for(auto &pair:relative)
+            sink += mod_abs_path(pair.first, pair.second).size();
+    });
+
+    // parse_specifiers reports everything it finds, which is part of what it costs
+    null_buffer discard;
+
+    benchmark("parse_specifiers (first line, quietly)", lines.size(), [&]()
+    {
+        std::streambuf *original = std::cout.rdbuf(&discard);
+        for(auto &line:lines)
+        {
+            specifiers spec;
+            parse_specifiers(line, spec);
+            sink += spec.engine.size();
+        }
+        std::cout.rdbuf(original);
+    });
+
+    std::cout << std::endl;
+    return 0;
+}
+
+static void write_file(const std::string &path, const std::string &contents)
+{
+    make_directories(parent_directory(path));
+    std::ofstream(path) << contents;
+}
+
+static std::string generate_project(const std::string &root, const project_shape &shape)
+{
+    // root/bin            the stub engine, which writes the files texbuild looks at and nothing else
+    // root/chain          a master= chain chain_depth files long, each one directory deeper than the last
+    // root/many           files separate masters, a few hundred per directory, all \input'ing root/shared.tex
+    // root/long           one document at the bottom of path_depth directories with long names
+    // returns the path of the deepest file in the chain
+    std::mt19937 rng(7);
+
+    write_file(join_path(root, std::string("bin/") + stub_engine),
+        "#!/bin/sh\n"
+        "# stands in for pdflatex, so only texbuild's own work gets measured\n"
+        "out=.; tex=\n"
+        "for a in \"$@\"; do\n"
+        "    case \"$a\" in\n"
+        "        --output-directory=*|-output-directory=*) out=\"${a#*=}\";;\n"
+        "        -*) ;;\n"
+        "        *) tex=\"$a\";;\n"
+        "    esac\n"
+        "done\n"
+        "job=$(basename \"${tex%.*}\")\n"
+        "echo \"This is texbuild-stub-engine\" > \"$out/$job.log\"\n"
+        "printf 'PWD %s\\nINPUT %s\\n' \"$PWD\" \"$tex\" > \"$out/$job.fls\"\n"
+        "echo '\\relax' > \"$out/$job.aux\"\n"
+        "echo stub > \"$out/$job.pdf\"\n");
+    chmod(join_path(root, std::string("bin/") + stub_engine).c_str(), 0755);
+
+    std::string specifiers = std::string("%engine=") + stub_engine + ";openwith=none\n";
+    std::string body = "\\documentclass{article}\n\\begin{document}\n\\input{shared}\n\\end{document}\n";
+
+    std::string dir = join_path(root, "chain");
+    write_file(join_path(dir, "doc.tex"), specifiers + body);
+    for(int i = 1; i < shape.chain_depth; i++)
+    {
+        dir = join_path(dir, "level" + std::to_string(i));
+        write_file(join_path(dir, "doc.tex"), "%master=../doc.tex\n\\section{Level " + std::to_string(i) + "}\n");
+    }
+    std::string deepest = join_path(dir, "doc.tex");
+
+    write_file(join_path(root, "shared.tex"), "Shared text.\n");
+    for(int i = 0; i < shape.files; i++)
+    {
+        std::string name = "part" + std::to_string(i / 250) + "/doc-" + std::to_string(i) + "-" + random_name(rng, 12) + ".tex";
+        write_file(join_path(root, "many/" + name), specifiers + "\\documentclass{article}\n\\begin{document}\n\\input{../../shared}\n\\end{document}\n");
+    }
+
+    dir = join_path(root, "long");
+    for(int i = 0; i < shape.path_depth; i++)
+        dir = join_path(dir, random_name(rng, shape.name_length));
+    write_file(join_path(dir, "doc.tex"), specifiers + "\\documentclass{article}\n\\begin{document}\nLong.\n\\end{document}\n");
+    write_file(join_path(root, "chain/shared.tex"), "Shared text.\n");
+
+    return deepest;
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static bool run_texbuild(const std::string &texbuild, const std::string &root, const std::vector<std::string> &args, double &seconds)
+{
+    // with the stub engine first on the PATH and a home directory of its own, so no cache or config leaks in
+    bench_clock::time_point start = bench_clock::now();
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        std::string path = join_path(root, "bin") + ":" + (getenv("PATH") ? getenv("PATH") : "/usr/bin:/bin");
+        setenv("PATH", path.c_str(), 1);
+        setenv("HOME", join_path(root, "home").c_str(), 1);
+
+        int devnull = open("/dev/null", O_RDWR);
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+
+        std::vector<char *> argv = {const_cast<char *>(texbuild.c_str())};
+        for(auto &arg:args)
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(NULL);
+
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 1;
+    if(pid > 0)
+        waitpid(pid, &status, 0);
+
+    seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void report(const std::string &name, const std::string &texbuild, const std::string &root,
+                   const std::vector<std::string> &args, int repeats, int documents)
+{
+    std::vector<double> times;
+    bool ok = true;
+
+    for(int i = 0; i < repeats; i++)
+    {
+        double seconds;
+        ok = run_texbuild(texbuild, root, args, seconds) && ok;
+        times.push_back(seconds);
+    }
+    std::sort(times.begin(), times.end());
+
+    double median = times[times.size() / 2];
+    std::cout << "  " << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(3)
+              << std::setw(9) << median << " s" << std::setw(10) << std::setprecision(2) << median / documents * 1e3
+              << " ms/document" << (ok ? "" : "  (texbuild failed)") << std::endl;
+}
+
+static int run_end_to_end(const std::string &texbuild)
+{
+    if(access(texbuild.c_str(), X_OK) != 0)
+    {
+        std::cout << "Error: can't run '" << texbuild << "', build it first" << std::endl;
+        return 1;
+    }
+
+    char root_template[] = "/tmp/texbuild-bench-XXXXXX";
+    if(mkdtemp(root_template) == NULL)
+    {
+        std::cout << "Error: could not create a temporary directory" << std::endl;
+        return 1;
+    }
+    std::string root = root_template;
+    project_shape shape = default_shape;
+    std::string deepest = generate_project(root, shape);
+    std::string longdoc;
+
+    std::vector<std::string> found;
+    list_files(join_path(root, "long"), ".tex", found);
+    for(auto &path:found)
+    {
+        if(path.substr(path.size() - 8) == "/doc.tex")
+            longdoc = path;
+    }
+
+    std::cout << "End to end, '" << texbuild << "' against a stub engine in '" << root << "'\n" << std::endl;
+
+    report("master= chain, " + std::to_string(shape.chain_depth) + " deep", texbuild, root,
+           {parent_directory(deepest), "doc.tex"}, 5, 1);
+    report("one document, " + std::to_string(longdoc.size()) + " character path", texbuild, root,
+           {parent_directory(longdoc), "doc.tex"}, 5, 1);
+    report("batch, " + std::to_string(shape.files) + " documents", texbuild, root,
+           {"--batch", join_path(root, "many")}, 1, shape.files);
+    report("batch --incremental, first build", texbuild, root,
+           {"--batch", "--incremental", join_path(root, "many")}, 1, shape.files);
+    report("batch --incremental, nothing changed", texbuild, root,
+           {"--batch", "--incremental", join_path(root, "many")}, 3, shape.files);
+    report("scan, " + std::to_string(shape.files) + " documents", texbuild, root,
+           {"--scan", join_path(root, "many")}, 3, shape.files);
+
+    nftw(root.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    std::cout << std::endl;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "all";
+
+    if(mode == "generate")
+    {
+        if(argc != 3)
+        {
+            std::cout << "Usage: bench generate <dir>" << std::endl;
+            return 1;
+        }
+        std::cout << "Deepest file in the master= chain: " << generate_project(absolute_path(argv[2]), default_shape) << std::endl;
+        return 0;
+    }
+
+    if((mode == "micro" || mode == "all") && run_microbenchmarks() != 0)
+        return 1;
+
+    if(mode == "e2e" || mode == "all")
+        return run_end_to_end(absolute_path(argc > 2 ? argv[2] : "./texbuild"));
+
+    if(mode != "micro" && mode != "all")
+    {
+        std::cout << "Usage: bench [micro | e2e [texbuild] | generate <dir>]" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include "cache.h"
+#include "fileutil.h"
+#include "process.h"
+
+#include <iostream>
+#include <fstream>
+#include <set>
+#include <cstdio>
+
+static const char *manifest_header = "texbuild-manifest 1";
+
+std::string cache_manifest_path(const build_job &job)
+{
+    return config_path + "cache/" + job_key(job) + ".manifest";
+}
+
+static uint64_t command_key(const build_job &job)
+{
+    // anything that changes what the build would do goes in here
+    uint64_t h = hash_string(version);
+    h = hash_string("\n" + job.compcall, h);
+    h = hash_string("\n" + job.bibcall, h);
+    for(auto argv:{&job.index_argv, &job.glossary_argv, &job.nomencl_argv})
+    {
+        if(!argv->empty())
+            h = hash_string("\n" + join_arguments(*argv), h);
+    }
+    return h;
+}
+
+static bool is_distribution_file(const std::string &path)
+{
+    // files belonging to the TeX installation only change when the installation does, don't bother hashing them
+    return path.find("/texmf-dist/") != std::string::npos || path.find("/texmf-var/") != std::string::npos
+        || path.find("/texmf-config/") != std::string::npos || path.find("/web2c/") != std::string::npos;
+}
+
+std::vector<std::string> read_recorded_inputs(const build_job &job)
+{
+    std::vector<std::string> inputs = read_fls_inputs(join_path(job.outdir, job.jobname + ".fls"), job.dir);
+
+    // the preamble's own inputs are in the format, so the engine never reads them itself
+    inputs.insert(inputs.end(), job.preamble_inputs.begin(), job.preamble_inputs.end());
+    return inputs;
+}
+
+std::vector<std::string> read_fls_inputs(const std::string &flspath, const std::string &dir)
+{
+    // the .fls file (written when the engine is given -recorder) lists every file opened, one per line:
+    //   PWD /the/working/directory
+    //   INPUT chapter1.tex
+    //   OUTPUT main.aux
+    std::ifstream ifile(flspath);
+    std::vector<std::string> inputs;
+    std::set<std::string> seen, outputs;
+    std::string line, pwd = dir;
+
+    while(getline(ifile, line))
+    {
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if(line.substr(0, 4) == "PWD ")
+        {
+            pwd = line.substr(4);
+        }
+        else if(line.substr(0, 6) == "INPUT " || line.substr(0, 7) == "OUTPUT ")
+        {
+            bool input = line[0] == 'I';
+            std::string path = line.substr(input ? 6 : 7);
+
+            if(path.substr(0, 2) == "./")
+                path.erase(0, 2);
+
+            path = join_path(pwd, path);
+
+            if(!input)
+                outputs.insert(path);
+            else if(!is_distribution_file(path) && seen.insert(path).second)
+                inputs.push_back(path);
+        }
+    }
+
+    // .aux, .toc etc. are both read and written by the engine, they are results of the build rather than inputs
+    std::vector<std::string> result;
+    for(auto &path:inputs)
+    {
+        if(outputs.find(path) == outputs.end())
+            result.push_back(path);
+    }
+    return result;
+}
+
+std::vector<std::string> find_bib_files(const build_job &job)
+{
+    std::vector<std::string> bibs;
+    std::string contents;
+
+    // biblatex/biber: <bcf:datasource type="file" datatype="bibtex">refs.bib</bcf:datasource>
+    if(read_whole_file(join_path(job.outdir, job.jobname + ".bcf"), contents))
+    {
+        size_t pos = 0;
+        while((pos = contents.find("<bcf:datasource", pos)) != std::string::npos)
+        {
+            size_t start = contents.find('>', pos);
+            size_t end = contents.find("</bcf:datasource>", pos);
+
+            if(start == std::string::npos || end == std::string::npos || end < start)
+                break;
+
+            bibs.push_back(contents.substr(start + 1, end - start - 1));
+            pos = end;
+        }
+    }
+
+    // bibtex: \bibdata{refs,more-refs}
+    if(read_whole_file(join_path(job.outdir, job.jobname + ".aux"), contents))
+    {
+        size_t pos = 0;
+        while((pos = contents.find("\\bibdata{", pos)) != std::string::npos)
+        {
+            size_t end = contents.find('}', pos);
+
+            if(end == std::string::npos)
+                break;
+
+            for(auto name:explode(contents.substr(pos + 9, end - pos - 9), ','))
+            {
+                if(name.size() < 4 || name.substr(name.size() - 4) != ".bib")
+                    name += ".bib";
+                bibs.push_back(name);
+            }
+            pos = end;
+        }
+    }
+
+    // only keep the ones that actually live in the project, the rest are in the TeX installation
+    std::vector<std::string> result;
+    for(auto &bib:bibs)
+    {
+        std::string path = join_path(job.dir, bib);
+
+        if(file_exists(path))
+            result.push_back(path);
+    }
+    return result;
+}
+
+bool cache_is_fresh(const build_job &job)
+{
+    if(force_build)
+        return false;
+
+    std::ifstream ifile(cache_manifest_path(job));
+    std::string line;
+
+    if(!getline(ifile, line) || line != manifest_header)
+        return false; // never built before (or built by an older version)
+
+    if(!getline(ifile, line) || line != "cmd " + hex64(command_key(job)))
+    {
+        std::cout << "Build commands have changed since the last build" << std::endl;
+        return false;
+    }
+
+    if(job.outext != "" && !file_exists(join_path(job.outdir, job.jobname + job.outext)))
+        return false; // output has been deleted
+
+    while(getline(ifile, line))
+    {
+        // in <hash> <path>
+        uint64_t recorded, current;
+
+        if(line.size() < 21 || line.substr(0, 3) != "in " || !parse_hex64(line.substr(3, 16), recorded))
+            return false; // manifest is corrupt, rebuild to be safe
+
+        std::string path = line.substr(20);
+
+        if(!hash_file(path, current) || current != recorded)
+        {
+            std::cout << "'" << path << "' has changed since the last build" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void cache_store(const build_job &job)
+{
+    std::vector<std::string> inputs = read_recorded_inputs(job);
+
+    if(inputs.empty())
+    {
+        // without the .fls there's no way to know what the build depended on, so don't pretend otherwise
+        std::cout << "Warning: no recorder output found, not caching this build" << std::endl;
+        return;
+    }
+
+    inputs.push_back(job.texpath);
+    for(auto &bib:find_bib_files(job))
+        inputs.push_back(bib);
+
+    if(!make_directories(config_path + "cache"))
+    {
+        std::cout << "Warning: could not create '" << config_path << "cache'" << std::endl;
+        return;
+    }
+
+    std::string path = cache_manifest_path(job);
+    std::ofstream ofile(path + ".tmp");
+    std::set<std::string> written;
+
+    ofile << manifest_header << "\n";
+    ofile << "cmd " << hex64(command_key(job)) << "\n";
+
+    for(auto &input:inputs)
+    {
+        uint64_t h;
+
+        if(written.insert(input).second && hash_file(input, h))
+            ofile << "in " << hex64(h) << " " << input << "\n";
+    }
+    ofile.close();
+
+    // write then rename, so a half written manifest is never read
+    if(!ofile || rename((path + ".tmp").c_str(), path.c_str()) != 0)
+        std::cout << "Warning: could not write build manifest '" << path << "'" << std::endl;
+}
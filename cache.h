@@ -0,0 +1,18 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+
+// incremental build cache, one manifest per master file in config_path/cache/
+bool cache_is_fresh(const build_job &job); // true if nothing has changed since the last successful build
+void cache_store(const build_job &job); // record what the last (successful) build read
+
+std::string cache_manifest_path(const build_job &job);
+std::vector<std::string> read_recorded_inputs(const build_job &job); // files the engine read, from the .fls file
+std::vector<std::string> read_fls_inputs(const std::string &flspath, const std::string &dir); // the same for any .fls
+std::vector<std::string> find_bib_files(const build_job &job); // .bib files named in the .bcf or .aux
+
+#endif
@@ -0,0 +1,641 @@
+#include "daemon.h"
+#include "masterindex.h"
+#include "fileutil.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <list>
+#include <map>
+#include <deque>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+typedef std::chrono::steady_clock daemon_clock;
+
+// the daemon streams a build's output to the client as it is, then a NUL (which TeX never prints) and the exit status
+static const char end_of_output = '\0';
+
+static const size_t max_history = 50;
+
+// a master as resolve_job left it, reused until the file or its master is edited
+struct resolved_master
+{
+    build_job job;
+    std::string output; // what resolving printed, passed on to every client that asks for it
+    time_t file_mtime, master_mtime;
+};
+
+// one build, queued or running, and the clients waiting for it
+struct daemon_build
+{
+    build_job job;
+    std::vector<int> clients;
+    int priority;               // higher goes first
+    bool force;                 // ignore the incremental build cache
+    unsigned long sequence;     // order of arrival, for breaking ties
+    pid_t pid;                  // -1 while queued
+    int outfd;                  // the build's stdout and stderr
+    daemon_clock::time_point start;
+};
+
+struct history_entry
+{
+    std::string texpath;
+    int rc;
+    double seconds;
+    time_t finished;
+};
+
+// a connection that hasn't sent its whole request yet
+struct pending_client
+{
+    int fd;
+    std::string request;
+};
+
+struct daemon_state
+{
+    int listenfd;
+    size_t jobs;
+    unsigned long sequence;
+    std::map<std::string, resolved_master> masters; // by the path that was asked for
+    std::list<daemon_build> builds;
+    std::list<pending_client> pending;
+    std::deque<history_entry> history;
+    std::map<std::string, double> durations; // how long each master took last time
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop(int)
+{
+    stopping = 1;
+}
+
+std::string daemon_socket_path()
+{
+    return config_path + "daemon.sock";
+}
+
+static time_t mtime_of(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+
+static void send_to(int fd, const std::string &data)
+{
+    // a client that has gone away only loses its own output, the build carries on for everyone else
+    size_t sent = 0;
+
+    while(sent < data.size())
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return;
+        sent += n;
+    }
+}
+
+static void finish_client(int fd, int rc)
+{
+    send_to(fd, std::string(1, end_of_output) + std::to_string(rc) + "\n");
+    close(fd);
+}
+
+static const resolved_master &resolve(daemon_state &state, const std::string &dir, const std::string &file)
+{
+    std::string path = dir + file;
+    auto cached = state.masters.find(path);
+
+    if(cached != state.masters.end() && cached->second.file_mtime == mtime_of(path)
+       && cached->second.master_mtime == mtime_of(cached->second.job.texpath))
+        return cached->second;
+
+    // resolve_job talks to cout, which here needs to go to the client instead
+    resolved_master &master = state.masters[path];
+    std::ostringstream captured;
+    std::streambuf *original = std::cout.rdbuf(captured.rdbuf());
+
+    master.job = build_job();
+    resolve_job(dir, file, master.job);
+    save_master_index();
+
+    std::cout.rdbuf(original);
+
+    master.output = captured.str();
+    master.file_mtime = mtime_of(path);
+    master.master_mtime = mtime_of(master.job.texpath);
+    return master;
+}
+
+static void enqueue(daemon_state &state, int fd, const std::string &dir, const std::string &file, int priority, bool force)
+{
+    if(!file_exists(dir + file))
+    {
+        send_to(fd, "Error: file '" + dir + file + "' does not exist\n");
+        finish_client(fd, 2);
+        return;
+    }
+
+    const resolved_master &master = resolve(state, dir, file);
+    send_to(fd, master.output);
+
+    // anything already waiting for the same master will build the same thing, so just wait for that one too
+    // one that is already running started before this save though, so it doesn't count
+    for(auto &build:state.builds)
+    {
+        if(build.pid < 0 && build.job.texpath == master.job.texpath)
+        {
+            send_to(fd, "\nJoining a build of '" + build.job.texpath + "' that is already queued\n");
+            build.clients.push_back(fd);
+            build.priority = std::max(build.priority, priority);
+            build.force = build.force || force;
+            return;
+        }
+    }
+
+    daemon_build build;
+    build.job = master.job;
+    build.clients.push_back(fd);
+    build.priority = priority;
+    build.force = force;
+    build.sequence = state.sequence++;
+    build.pid = -1;
+    build.outfd = -1;
+    state.builds.push_back(build);
+
+    size_t ahead = 0;
+    for(auto &other:state.builds)
+        ahead += other.pid >= 0 ? 1 : 0;
+    if(ahead >= state.jobs)
+        send_to(fd, "\nQueued, " + std::to_string(state.builds.size() - 1) + " other builds ahead or running\n");
+}
+
+static std::string status_report(const daemon_state &state)
+{
+    std::ostringstream report;
+    daemon_clock::time_point now = daemon_clock::now();
+
+    report << "texbuild daemon, " << state.masters.size() << " resolved masters cached\n\n";
+
+    for(auto &build:state.builds)
+    {
+        if(build.pid >= 0)
+            report << "running  " << std::fixed << std::setprecision(1) << std::setw(6)
+                   << std::chrono::duration<double>(now - build.start).count() << "s  " << build.job.texpath << "\n";
+    }
+    for(auto &build:state.builds)
+    {
+        if(build.pid < 0)
+            report << "queued   priority " << build.priority << "  " << build.job.texpath << "\n";
+    }
+
+    report << "\nRecent builds:\n";
+    for(auto entry = state.history.rbegin(); entry != state.history.rend(); ++entry)
+    {
+        char when[32];
+        strftime(when, sizeof when, "%H:%M:%S", localtime(&entry->finished));
+        report << when << "  " << (entry->rc == 0 ? "built " : "FAILED") << "  " << std::fixed << std::setprecision(1)
+               << std::setw(6) << entry->seconds << "s  " << entry->texpath << "\n";
+    }
+    return report.str();
+}
+
+static void handle_request(daemon_state &state, int fd, const std::string &request)
+{
+    // build <dir> <file> <priority> <force>, status or stop, tab separated
+    std::vector<std::string> fields;
+    size_t start = 0, tab;
+
+    while((tab = request.find('\t', start)) != std::string::npos)
+    {
+        fields.push_back(request.substr(start, tab - start));
+        start = tab + 1;
+    }
+    fields.push_back(request.substr(start));
+
+    if(fields[0] == "build" && fields.size() == 5)
+        enqueue(state, fd, fields[1], fields[2], atoi(fields[3].c_str()), fields[4] == "1");
+    else if(fields[0] == "status")
+    {
+        send_to(fd, status_report(state));
+        finish_client(fd, 0);
+    }
+    else if(fields[0] == "stop")
+    {
+        send_to(fd, "Stopping the texbuild daemon\n");
+        finish_client(fd, 0);
+        stopping = 1;
+    }
+    else
+    {
+        send_to(fd, "Error: the daemon doesn't understand '" + fields[0] + "'\n");
+        finish_client(fd, 1);
+    }
+}
+
+static void close_inherited(const daemon_state &state)
+{
+    // a build child has no business with the other clients, and holding their sockets open would confuse them
+    close(state.listenfd);
+    for(auto &client:state.pending)
+        close(client.fd);
+    for(auto &build:state.builds)
+    {
+        for(int fd:build.clients)
+            close(fd);
+        if(build.outfd >= 0)
+            close(build.outfd);
+    }
+}
+
+static void fail_build(daemon_build &build)
+{
+    // out of processes or file descriptors, trying again straight away would only fail the same way
+    for(int fd:build.clients)
+    {
+        send_to(fd, "Error: the daemon could not start the build\n");
+        finish_client(fd, 1);
+    }
+    build.clients.clear();
+    build.pid = 0; // removed along with the finished builds
+}
+
+static void start_build(daemon_state &state, daemon_build &build)
+{
+    int outpipe[2];
+
+    if(pipe2(outpipe, O_CLOEXEC) != 0)
+    {
+        fail_build(build);
+        return;
+    }
+
+    std::cout.flush();
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        close_inherited(state);
+        setpgid(0, 0); // so stopping the daemon can take the engine down with the build
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        dup2(outpipe[1], STDOUT_FILENO);
+        dup2(outpipe[1], STDERR_FILENO);
+
+        force_build = build.force;
+
+        std::cout << "This is TeXbuild v" << version << " (daemon), building '" << build.job.texpath << "'" << std::endl;
+        int rc = execute_command(build.job);
+
+        std::cout.flush();
+        _exit(rc == 0 ? 0 : 1);
+    }
+
+    close(outpipe[1]);
+
+    if(pid < 0)
+    {
+        close(outpipe[0]);
+        fail_build(build);
+        return;
+    }
+
+    setpgid(pid, pid);
+    fcntl(outpipe[0], F_SETFL, O_NONBLOCK);
+    build.pid = pid;
+    build.outfd = outpipe[0];
+    build.start = daemon_clock::now();
+}
+
+static void schedule(daemon_state &state)
+{
+    for(;;)
+    {
+        size_t running = 0;
+        daemon_build *best = NULL;
+
+        for(auto &build:state.builds)
+        {
+            if(build.pid >= 0)
+                running++;
+        }
+        if(running >= state.jobs)
+            return;
+
+        for(auto &build:state.builds)
+        {
+            if(build.pid >= 0)
+                continue;
+
+            // never two builds of the same master at once, they'd write over each other's .aux
+            bool busy = false;
+            for(auto &other:state.builds)
+                busy = busy || (other.pid >= 0 && other.job.texpath == build.job.texpath);
+            if(busy)
+                continue;
+
+            // highest priority first, then whatever is expected to finish soonest, then first come first served
+            if(best == NULL || build.priority > best->priority
+               || (build.priority == best->priority && state.durations[build.job.texpath] < state.durations[best->job.texpath])
+               || (build.priority == best->priority && state.durations[build.job.texpath] == state.durations[best->job.texpath]
+                   && build.sequence < best->sequence))
+                best = &build;
+        }
+        if(best == NULL)
+            return;
+
+        start_build(state, *best);
+    }
+}
+
+static void forward_output(daemon_build &build)
+{
+    // whatever the build has printed so far, to everyone waiting on it
+    char buffer[4096];
+    ssize_t n;
+
+    while((n = read(build.outfd, buffer, sizeof buffer)) > 0)
+    {
+        std::string chunk(buffer, n);
+        for(int fd:build.clients)
+            send_to(fd, chunk);
+    }
+}
+
+static void finish_build(daemon_state &state, daemon_build &build, int status)
+{
+    int rc = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    double seconds = std::chrono::duration<double>(daemon_clock::now() - build.start).count();
+
+    for(int fd:build.clients)
+        finish_client(fd, rc);
+    build.clients.clear();
+
+    close(build.outfd);
+    build.outfd = -1;
+
+    history_entry entry = {build.job.texpath, rc, seconds, time(NULL)};
+    state.history.push_back(entry);
+    if(state.history.size() > max_history)
+        state.history.pop_front();
+    state.durations[build.job.texpath] = seconds;
+
+    std::cout << (rc == 0 ? "built   " : "FAILED  ") << std::fixed << std::setprecision(1) << std::setw(6) << seconds
+              << "s  " << build.job.texpath << std::endl;
+}
+
+int run_daemon(int jobs)
+{
+    std::string path = daemon_socket_path();
+    struct sockaddr_un address = {};
+
+    if(path.size() >= sizeof address.sun_path)
+    {
+        std::cout << "Error: the socket path '" << path << "' is too long" << std::endl;
+        return 1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+
+    make_directories(config_path);
+
+    daemon_state state;
+    state.listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    state.jobs = jobs > 0 ? jobs : std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    state.sequence = 0;
+
+    // a socket file left behind by a daemon that didn't get to clean up is fine to replace, a live one isn't
+    if(connect(state.listenfd, (struct sockaddr *)&address, sizeof address) == 0)
+    {
+        std::cout << "Error: a texbuild daemon is already running on '" << path << "'" << std::endl;
+        close(state.listenfd);
+        return 1;
+    }
+    close(state.listenfd);
+    unlink(path.c_str());
+
+    state.listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t oldmask = umask(0077); // only this user gets to start builds
+    bool bound = bind(state.listenfd, (struct sockaddr *)&address, sizeof address) == 0;
+    umask(oldmask);
+
+    if(!bound || listen(state.listenfd, 64) != 0)
+    {
+        std::cout << "Error: could not listen on '" << path << "': " << strerror(errno) << std::endl;
+        close(state.listenfd);
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = on_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "Listening on '" << path << "', building up to " << state.jobs << " documents at once" << std::endl;
+
+    char buffer[4096];
+
+    while(!stopping)
+    {
+        std::vector<struct pollfd> fds;
+        fds.push_back({state.listenfd, POLLIN, 0});
+        for(auto &client:state.pending)
+            fds.push_back({client.fd, POLLIN, 0});
+        for(auto &build:state.builds)
+        {
+            if(build.outfd >= 0)
+                fds.push_back({build.outfd, POLLIN, 0});
+        }
+
+        // builds finishing are only noticed by checking on them, so do that regularly while there are any
+        if(poll(fds.data(), fds.size(), fds.size() > 1 + state.pending.size() ? 100 : -1) < 0)
+            continue; // interrupted, most likely by the signal to stop
+
+        size_t i = 1;
+
+        for(auto client = state.pending.begin(); client != state.pending.end(); i++)
+        {
+            if(!(fds[i].revents & (POLLIN | POLLHUP)))
+            {
+                ++client;
+                continue;
+            }
+
+            ssize_t n = recv(client->fd, buffer, sizeof buffer, 0);
+            if(n > 0)
+                client->request.append(buffer, n);
+
+            size_t newline = client->request.find('\n');
+            if(newline != std::string::npos)
+                handle_request(state, client->fd, client->request.substr(0, newline));
+            else if(n <= 0 || client->request.size() > 65536)
+                close(client->fd);
+            else
+            {
+                ++client;
+                continue;
+            }
+            client = state.pending.erase(client);
+        }
+
+        for(auto &build:state.builds)
+        {
+            if(build.outfd < 0)
+                continue;
+
+            if(fds[i++].revents & (POLLIN | POLLHUP))
+                forward_output(build);
+
+            // the build is over when the child exits, not when the pipe closes, which anything the engine left
+            // running in the background could hold open for as long as it likes
+            int status;
+            if(waitpid(build.pid, &status, WNOHANG) == build.pid)
+            {
+                forward_output(build);
+                finish_build(state, build, status);
+            }
+        }
+
+        // finished builds have no output left and no clients
+        for(auto build = state.builds.begin(); build != state.builds.end(); )
+        {
+            if(build->pid >= 0 && build->outfd < 0)
+                build = state.builds.erase(build);
+            else
+                ++build;
+        }
+
+        if(fds[0].revents & POLLIN)
+        {
+            int fd = accept4(state.listenfd, NULL, NULL, SOCK_CLOEXEC);
+            if(fd >= 0)
+            {
+                struct timeval timeout = {2, 0}; // a client that stops reading can't hold up everyone else for long
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+                state.pending.push_back({fd, ""});
+            }
+        }
+
+        schedule(state);
+    }
+
+    std::cout << "Stopping" << std::endl;
+
+    for(auto &build:state.builds)
+    {
+        if(build.pid > 0)
+        {
+            killpg(build.pid, SIGTERM);
+            waitpid(build.pid, NULL, 0);
+        }
+        for(int fd:build.clients)
+        {
+            send_to(fd, "\nError: the texbuild daemon was stopped\n");
+            finish_client(fd, 1);
+        }
+        if(build.outfd >= 0)
+            close(build.outfd);
+    }
+    for(auto &client:state.pending)
+        close(client.fd);
+
+    close(state.listenfd);
+    unlink(path.c_str());
+    return 0;
+}
+
+int run_client(const std::vector<std::string> &args, int priority)
+{
+    std::string path = daemon_socket_path(), request;
+    struct sockaddr_un address = {};
+
+    if(args.size() == 1 && (args[0] == "status" || args[0] == "stop"))
+        request = args[0];
+    else if(args.size() == 2)
+    {
+        // the daemon has its own working directory, so it needs the full path
+        std::string dir = absolute_path(args[0]);
+        if(dir.back() != '/')
+            dir += '/';
+        request = "build\t" + dir + "\t" + args[1] + "\t" + std::to_string(priority) + "\t" + (force_build ? "1" : "0");
+    }
+    else
+    {
+        std::cout << "Error: --client takes a directory and file, 'status' or 'stop'" << std::endl;
+        return 1;
+    }
+
+    if(path.size() >= sizeof address.sun_path)
+        return -1;
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof address) != 0)
+    {
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    send_to(fd, request + "\n");
+
+    char buffer[4096];
+    std::string status;
+    bool finished = false;
+    ssize_t n;
+
+    while((n = recv(fd, buffer, sizeof buffer, 0)) > 0 || (n < 0 && errno == EINTR))
+    {
+        if(n < 0)
+            continue;
+
+        if(!finished)
+        {
+            char *end = (char *)memchr(buffer, end_of_output, n);
+            std::cout.write(buffer, end ? end - buffer : n);
+            std::cout.flush();
+
+            if(end)
+            {
+                finished = true;
+                status.append(end + 1, buffer + n - end - 1);
+            }
+        }
+        else
+            status.append(buffer, n);
+
+        if(finished && status.find('\n') != std::string::npos)
+            break;
+    }
+    close(fd);
+
+    if(!finished)
+    {
+        std::cout << "\nError: lost the connection to the texbuild daemon" << std::endl;
+        return 1;
+    }
+    return atoi(status.c_str());
+}
+
+#endif
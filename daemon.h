@@ -0,0 +1,22 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+
+#ifdef SYSTEM_IS_LINUX
+// texbuild --daemon keeps resolved masters, recent build times and a queue of pending builds for the whole machine,
+// and takes requests over the Unix socket config_path/daemon.sock, so editors can ask for a build on every save
+std::string daemon_socket_path();
+
+// serves requests until stopped, building at most jobs documents at once (0 for one per core)
+int run_daemon(int jobs);
+
+// texbuild --client <dir> <file>, texbuild --client status or texbuild --client stop
+// prints what the daemon sends back and returns the build's exit status, or -1 if no daemon is running
+int run_client(const std::vector<std::string> &args, int priority);
+#endif
+
+#endif
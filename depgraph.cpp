@@ -0,0 +1,480 @@
+#include "depgraph.h"
+#include "batch.h"
+#include "fileutil.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <set>
+#include <cstring>
+#include <cstdio>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#ifdef SYSTEM_IS_LINUX
+    #include <sys/file.h>
+    #include <fcntl.h>
+#endif
+
+static const char *graph_header = "texbuild-depgraph 1";
+static const char *kind_letters = "ICSGBP"; // indexed by reference_kind, for the on-disk format
+
+// the commands the scanner knows about, anything else after a backslash is skipped over
+static const struct { const char *name; reference_kind kind; } reference_commands[] = {
+    {"input", ref_input},
+    {"include", ref_include},
+    {"subfile", ref_subfile},
+    {"includegraphics", ref_graphics},
+    {"bibliography", ref_bibliography},
+    {"addbibresource", ref_bibliography},
+    {"graphicspath", ref_graphicspath}
+};
+
+// extensions graphicx tries, in order, when \includegraphics doesn't give one, then those only a conversion makes usable
+static const char *graphics_extensions[] = {".pdf", ".png", ".jpg", ".jpeg", ".eps", ".svg", ".puml"};
+
+static const char *find_backslash_or_percent(const char *p, const char *end)
+{
+    // backslashes and comment characters are rare in TeX source, so look at 16 bytes at a time where possible
+    #ifdef __SSE2__
+    const __m128i backslash = _mm_set1_epi8('\\'), percent = _mm_set1_epi8('%');
+
+    while(end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, percent)));
+
+        if(mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    #endif
+    while(p < end && *p != '\\' && *p != '%')
+        p++;
+    return p;
+}
+
+static const char *skip_group(const char *p, const char *end, char open, char close, std::string *contents)
+{
+    // p is just after the opening bracket, returns just after the matching closing one
+    int depth = 1;
+    const char *start = p;
+
+    for(; p < end; p++)
+    {
+        if(*p == '\\' && p + 1 < end)
+            p++;
+        else if(*p == open)
+            depth++;
+        else if(*p == close && --depth == 0)
+        {
+            if(contents)
+                contents->assign(start, p);
+            return p + 1;
+        }
+    }
+    return end;
+}
+
+static bool is_letter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+void scan_references(const char *data, size_t len, std::vector<tex_reference> &refs)
+{
+    const char *p = data, *end = data + len, *counted = data;
+    size_t line = 1;
+
+    while((p = find_backslash_or_percent(p, end)) < end)
+    {
+        if(*p == '%') // comment, skip the rest of the line
+        {
+            const char *eol = (const char *)memchr(p, '\n', end - p);
+            p = eol ? eol : end;
+            continue;
+        }
+
+        const char *name = ++p;
+        while(p < end && is_letter(*p))
+            p++;
+
+        if(p == name) // control symbol such as \% or \\, which mustn't be mistaken for a comment or a command
+        {
+            if(p < end) // a backslash can be the last byte of the file
+                p++;
+            continue;
+        }
+
+        size_t namelen = p - name;
+        int found = -1;
+
+        for(size_t i = 0; i < sizeof reference_commands / sizeof reference_commands[0]; i++)
+        {
+            if(strlen(reference_commands[i].name) == namelen && memcmp(reference_commands[i].name, name, namelen) == 0)
+            {
+                found = i;
+                break;
+            }
+        }
+        if(found < 0)
+            continue;
+
+        tex_reference ref;
+        ref.kind = reference_commands[found].kind;
+
+        // only worked out when needed, most backslashes aren't interesting
+        line += std::count(counted, p, '\n');
+        counted = p;
+        ref.line = line;
+
+        if(p < end && *p == '*')
+            p++;
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+        while(p < end && *p == '[') // optional arguments, e.g. \includegraphics[width=\textwidth]
+        {
+            p = skip_group(p + 1, end, '[', ']', NULL);
+            while(p < end && (*p == ' ' || *p == '\t'))
+                p++;
+        }
+
+        if(p < end && *p == '{')
+        {
+            p = skip_group(p + 1, end, '{', '}', &ref.target);
+        }
+        else if(ref.kind == ref_input) // plain TeX style, \input chapter1
+        {
+            const char *start = p;
+            while(p < end && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t' && *p != '%' && *p != '\\')
+                p++;
+            ref.target.assign(start, p);
+        }
+
+        // trim, and give up on anything built from macros since there's no knowing what it expands to
+        ref.target.erase(0, ref.target.find_first_not_of(" \t\r\n"));
+        ref.target.erase(ref.target.find_last_not_of(" \t\r\n") + 1);
+
+        if(ref.target != "" && ref.target.find('#') == std::string::npos
+            && (ref.kind == ref_graphicspath || ref.target.find('\\') == std::string::npos))
+            refs.push_back(ref);
+    }
+}
+
+static bool has_extension(const std::string &path)
+{
+    size_t dotpos = path.find_last_of('.');
+    return dotpos != std::string::npos && (path.find_last_of('/') == std::string::npos || dotpos > path.find_last_of('/'));
+}
+
+static std::vector<std::string> resolve_reference(const tex_reference &ref, const std::string &basedir, const std::vector<std::string> &graphicspaths)
+{
+    std::vector<std::string> paths;
+
+    switch(ref.kind)
+    {
+    case ref_input:
+    case ref_subfile:
+    {
+        // TeX tries name.tex before name
+        std::string path = join_path(basedir, ref.target);
+        if(file_exists(path + ".tex") || (!file_exists(path) && !has_extension(ref.target)))
+            path += ".tex";
+        paths.push_back(path);
+        break;
+    }
+    case ref_include:
+        paths.push_back(join_path(basedir, ref.target + ".tex"));
+        break;
+    case ref_graphics:
+    {
+        std::vector<std::string> dirs(1, basedir);
+        for(auto &dir:graphicspaths)
+            dirs.push_back(join_path(basedir, dir));
+
+        for(auto &dir:dirs)
+        {
+            std::string path = join_path(dir, ref.target);
+
+            if(has_extension(ref.target) && file_exists(path))
+                return std::vector<std::string>(1, path);
+
+            for(auto ext:graphics_extensions)
+            {
+                if(file_exists(path + ext))
+                    return std::vector<std::string>(1, path + ext);
+            }
+        }
+        paths.push_back(join_path(basedir, ref.target)); // missing, but still worth knowing about
+        break;
+    }
+    case ref_bibliography:
+        for(auto name:explode(ref.target, ','))
+        {
+            name.erase(0, name.find_first_not_of(" \t\r\n"));
+            name.erase(name.find_last_not_of(" \t\r\n") + 1);
+            if(!has_extension(name))
+                name += ".bib";
+            paths.push_back(join_path(basedir, name));
+        }
+        break;
+    case ref_graphicspath:
+        break;
+    }
+    return paths;
+}
+
+std::vector<dependency> scan_dependencies(const std::string &master)
+{
+    // TeX looks everything up relative to the directory it was started in, which is the master's
+    std::string basedir = parent_directory(master);
+    std::vector<dependency> deps;
+    std::vector<std::string> pending(1, master), graphicspaths;
+    std::set<std::string> seen;
+    std::string contents;
+
+    seen.insert(master);
+
+    while(!pending.empty())
+    {
+        std::string file = pending.back();
+        pending.pop_back();
+
+        std::vector<tex_reference> refs;
+        if(!read_whole_file(file, contents))
+            continue;
+        scan_references(contents.data(), contents.size(), refs);
+
+        for(auto &ref:refs)
+        {
+            if(ref.kind == ref_graphicspath) // \graphicspath{{figures/}{images/}}
+            {
+                for(auto &dir:explode(ref.target, '}'))
+                {
+                    if(dir.size() > 1 && dir[0] == '{')
+                        graphicspaths.push_back(dir.substr(1));
+                }
+                continue;
+            }
+
+            for(auto path:resolve_reference(ref, basedir, graphicspaths))
+            {
+                path = normalise_path(path);
+
+                if(!seen.insert(path).second)
+                    continue;
+
+                dependency dep;
+                dep.kind = ref.kind;
+                dep.path = path;
+                dep.parent = file;
+                deps.push_back(dep);
+
+                if(ref.kind == ref_input || ref.kind == ref_include || ref.kind == ref_subfile)
+                    pending.push_back(path);
+            }
+        }
+    }
+    return deps;
+}
+
+std::string include_unit(const std::string &master, const std::string &path)
+{
+    // follow what pulled path in back towards the master, stopping at the first \include on the way
+    std::vector<dependency> deps = scan_dependencies(master);
+    std::string current = normalise_path(path);
+
+    for(size_t depth = 0; depth < deps.size(); depth++)
+    {
+        auto found = std::find_if(deps.begin(), deps.end(), [&current](const dependency &dep) { return dep.path == current; });
+
+        if(found == deps.end())
+            return ""; // not part of the document at all, or only reached through the master itself
+        if(found->kind != ref_include)
+        {
+            current = normalise_path(found->parent);
+            continue;
+        }
+
+        // \includeonly matches the name exactly as the \include wrote it, so find that again
+        std::string contents;
+        std::vector<tex_reference> refs;
+        std::vector<std::string> graphicspaths;
+
+        if(!read_whole_file(found->parent, contents))
+            return "";
+        scan_references(contents.data(), contents.size(), refs);
+
+        for(auto &ref:refs)
+        {
+            if(ref.kind == ref_include && normalise_path(resolve_reference(ref, parent_directory(master), graphicspaths)[0]) == current)
+                return ref.target;
+        }
+        return "";
+    }
+    return "";
+}
+
+bool load_dependency_graph(dependency_graph &graph)
+{
+    // M <master>
+    // D <kind> <path>\t<parent>
+    std::ifstream ifile(config_path + "depgraph");
+    std::string line, master;
+
+    graph.clear();
+
+    if(!getline(ifile, line) || line != graph_header)
+        return false;
+
+    while(getline(ifile, line))
+    {
+        if(line.substr(0, 2) == "M ")
+        {
+            master = line.substr(2);
+            graph[master];
+        }
+        else if(line.substr(0, 2) == "D " && line.size() > 4 && master != "")
+        {
+            const char *kind = strchr(kind_letters, line[2]);
+            size_t tabpos = line.find('\t', 4);
+
+            if(!kind || tabpos == std::string::npos)
+                continue;
+
+            dependency dep;
+            dep.kind = (reference_kind)(kind - kind_letters);
+            dep.path = line.substr(4, tabpos - 4);
+            dep.parent = line.substr(tabpos + 1);
+            graph[master].push_back(dep);
+        }
+    }
+    return true;
+}
+
+bool save_dependency_graph(const dependency_graph &graph)
+{
+    std::string path = config_path + "depgraph";
+
+    if(!make_directories(config_path))
+        return false;
+
+    std::ofstream ofile(path + ".tmp");
+
+    ofile << graph_header << "\n";
+    for(auto &entry:graph)
+    {
+        ofile << "M " << entry.first << "\n";
+        for(auto &dep:entry.second)
+            ofile << "D " << kind_letters[dep.kind] << " " << dep.path << "\t" << dep.parent << "\n";
+    }
+    ofile.close();
+
+    return ofile && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+}
+
+// symlinks resolved, so a file reached through a linked directory matches however --affected is given it.
+// realpath only resolves files that exist, and a deleted file still affects its masters, so those go by their directory
+static std::string canonical_path(const std::string &path)
+{
+    if(file_exists(path))
+        return absolute_path(path);
+
+    std::string dir = parent_directory(path);
+    return normalise_path(join_path(absolute_path(dir == "" ? "." : dir), path.substr(dir.size() + (dir == "" ? 0 : 1))));
+}
+
+void update_dependency_graph(const std::string &master, const std::vector<dependency> &deps)
+{
+    dependency_graph graph;
+    std::vector<dependency> canonical = deps;
+
+    for(auto &dep:canonical)
+    {
+        dep.path = canonical_path(dep.path);
+        dep.parent = canonical_path(dep.parent);
+    }
+
+    #ifdef SYSTEM_IS_LINUX
+    // batch builds update the graph from several processes at once, take turns so nobody's entry gets lost
+    make_directories(config_path);
+    int lockfd = open((config_path + "depgraph.lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if(lockfd >= 0)
+        flock(lockfd, LOCK_EX);
+    #endif
+
+    load_dependency_graph(graph);
+    graph[canonical_path(master)] = canonical;
+
+    if(!save_dependency_graph(graph))
+        std::cout << "Warning: could not save the dependency graph to '" << config_path << "depgraph'" << std::endl;
+
+    #ifdef SYSTEM_IS_LINUX
+    if(lockfd >= 0)
+        close(lockfd); // releases the lock too
+    #endif
+}
+
+std::vector<std::string> affected_masters(const dependency_graph &graph, const std::string &path)
+{
+    std::vector<std::string> masters;
+
+    for(auto &entry:graph)
+    {
+        bool affected = entry.first == path;
+
+        for(auto &dep:entry.second)
+        {
+            if(affected)
+                break;
+            affected = dep.path == path;
+        }
+        if(affected)
+            masters.push_back(entry.first);
+    }
+    return masters;
+}
+
+#ifdef SYSTEM_IS_LINUX
+int scan_command(const std::vector<std::string> &paths)
+{
+    std::vector<build_job> jobs = resolve_masters(expand_batch_paths(paths));
+
+    for(auto &job:jobs)
+    {
+        std::vector<dependency> deps = scan_dependencies(job.texpath);
+
+        std::cout << job.texpath << ": " << deps.size() << (deps.size() == 1 ? " dependency" : " dependencies") << std::endl;
+        for(auto &dep:deps)
+            std::cout << "  " << dep.path << (file_exists(dep.path) ? "" : " (missing)") << std::endl;
+
+        update_dependency_graph(job.texpath, deps);
+    }
+    return jobs.empty() ? 1 : 0;
+}
+
+int affected_command(const std::vector<std::string> &paths)
+{
+    dependency_graph graph;
+    std::set<std::string> printed;
+
+    if(!load_dependency_graph(graph))
+    {
+        std::cout << "Error: no dependency graph yet, run texbuild --scan first" << std::endl;
+        return 1;
+    }
+
+    // one master per line and nothing else, so the output can go straight into texbuild --batch
+    for(auto &path:paths)
+    {
+        for(auto &master:affected_masters(graph, canonical_path(path)))
+        {
+            if(printed.insert(master).second)
+                std::cout << master << std::endl;
+        }
+    }
+    return 0;
+}
+#endif
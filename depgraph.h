@@ -0,0 +1,47 @@
+#ifndef DEPGRAPH_H
+#define DEPGRAPH_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+
+enum reference_kind { ref_input, ref_include, ref_subfile, ref_graphics, ref_bibliography, ref_graphicspath };
+
+// one \input{...}, \includegraphics{...} etc found in a source file
+struct tex_reference
+{
+    reference_kind kind;
+    std::string target; // exactly as written between the braces
+    size_t line;        // 1 based
+};
+
+// one file a master depends on, and the file that pulled it in
+struct dependency
+{
+    reference_kind kind;
+    std::string path;
+    std::string parent;
+};
+
+// master file -> everything it reads, stored in config_path/depgraph
+typedef std::map<std::string, std::vector<dependency> > dependency_graph;
+
+void scan_references(const char *data, size_t len, std::vector<tex_reference> &refs); // skips comments
+std::vector<dependency> scan_dependencies(const std::string &master); // follows \input, \include and \subfile
+std::string include_unit(const std::string &master, const std::string &path); // the \include path is part of, as written, or ""
+
+bool load_dependency_graph(dependency_graph &graph);
+bool save_dependency_graph(const dependency_graph &graph);
+void update_dependency_graph(const std::string &master, const std::vector<dependency> &deps); // safe to call from several processes
+
+std::vector<std::string> affected_masters(const dependency_graph &graph, const std::string &path);
+
+#ifdef SYSTEM_IS_LINUX
+int scan_command(const std::vector<std::string> &paths); // texbuild --scan, (re)scan the masters of these files
+int affected_command(const std::vector<std::string> &paths); // texbuild --affected, print the masters these files feed into
+#endif
+
+#endif
@@ -0,0 +1,336 @@
+#include "diagnostics.h"
+#include "fileutil.h"
+
+#include <iostream>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+
+#ifdef SYSTEM_IS_LINUX
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// TeX breaks any line longer than this, so a line of exactly this length carries on in the next one
+static const size_t max_print_line = 79;
+
+// give up waiting for the l.<n> line of an error after this many lines of context
+static const int max_error_lines = 20;
+
+// things LaTeX and its packages write when the document needs another pass
+static const char *rerun_signals[] = {
+    "Rerun to get",
+    "Please rerun LaTeX",
+    "Rerun LaTeX",
+    "Label(s) may have changed",
+    "Citation(s) may have changed"
+};
+
+// how warnings start, e.g. "Package hyperref Warning: ...", as well as "pdfTeX warning (ext4): ..."
+static const char *warning_starts[] = {"LaTeX ", "Package ", "Class "};
+
+static bool starts_with(const char *line, size_t len, const char *prefix)
+{
+    size_t plen = strlen(prefix);
+    return len >= plen && memcmp(line, prefix, plen) == 0;
+}
+
+static const char *find_in(const char *line, size_t len, const char *needle)
+{
+    size_t nlen = strlen(needle);
+
+    for(const char *p = line; p + nlen <= line + len; p++)
+    {
+        p = (const char *)memchr(p, needle[0], line + len - p);
+        if(p == NULL || p + nlen > line + len)
+            return NULL;
+        if(memcmp(p, needle, nlen) == 0)
+            return p;
+    }
+    return NULL;
+}
+
+static size_t number_after(const char *line, size_t len, const char *marker)
+{
+    // e.g. the 12 in "... on input line 12."
+    const char *p = find_in(line, len, marker);
+
+    if(p == NULL)
+        return 0;
+    return strtoul(std::string(p + strlen(marker), line + len).c_str(), NULL, 10);
+}
+
+output_parser::output_parser() : error_lines(-1), continuing(false), rerun(false), fatal(false)
+{
+}
+
+void output_parser::feed(const char *data, size_t len)
+{
+    const char *end = data + len;
+
+    while(data < end)
+    {
+        const char *newline = (const char *)memchr(data, '\n', end - data);
+
+        if(newline == NULL)
+        {
+            partial.append(data, end - data);
+            return;
+        }
+
+        if(partial != "")
+        {
+            partial.append(data, newline - data);
+            take_line(partial.data(), partial.size());
+            partial.clear();
+        }
+        else
+            take_line(data, newline - data);
+
+        data = newline + 1;
+    }
+}
+
+void output_parser::finish()
+{
+    if(partial != "")
+        take_line(partial.data(), partial.size());
+    partial.clear();
+
+    if(wrapped != "")
+        parse_line(wrapped.data(), wrapped.size());
+    wrapped.clear();
+}
+
+void output_parser::take_line(const char *line, size_t len)
+{
+    if(len > 0 && line[len - 1] == '\r')
+        len--;
+
+    if(len == max_print_line)
+    {
+        wrapped.append(line, len); // the rest is on the next line
+        return;
+    }
+    if(wrapped != "")
+    {
+        wrapped.append(line, len);
+        parse_line(wrapped.data(), wrapped.size());
+        wrapped.clear();
+    }
+    else
+        parse_line(line, len);
+}
+
+void output_parser::parse_line(const char *line, size_t len)
+{
+    if(error_lines >= 0)
+    {
+        // the lines after "! Undefined control sequence." show where it happened, ending with "l.12 \foo"
+        error_lines++;
+
+        if(starts_with(line, len, "l.") && len > 2 && isdigit((unsigned char)line[2]))
+        {
+            found.back().line = strtoul(std::string(line + 2, len - 2).c_str(), NULL, 10);
+            error_lines = -1;
+            fatal = true;
+        }
+        else if(error_lines > max_error_lines)
+        {
+            error_lines = -1;
+            fatal = true;
+        }
+        return; // the context is the document's own text, its brackets don't open or close anything
+    }
+
+    if(continuing)
+    {
+        // "Package hyperref Warning: Token not allowed..." carries on with "(hyperref)      removing..." lines,
+        // LaTeX's own warnings with lines of spaces
+        size_t indent = 0, spaces = 0;
+
+        if(len > 0 && line[0] == '(')
+        {
+            const char *close = (const char *)memchr(line, ')', len);
+            if(close != NULL)
+                indent = close - line + 1;
+        }
+        while(indent < len && line[indent] == ' ')
+        {
+            indent++;
+            spaces++;
+        }
+
+        if(spaces >= 4 && indent < len)
+        {
+            diagnostic &d = found.back();
+            d.message += " " + std::string(line + indent, len - indent);
+            if(d.line == 0)
+                d.line = number_after(line, len, "input line ");
+            if(find_in(line, len, "undefined on input line"))
+                d.kind = diag_undefined_reference;
+            return;
+        }
+        continuing = false;
+    }
+
+    if(starts_with(line, len, "! "))
+    {
+        add(diag_error, std::string(line + 2, len - 2), 0);
+        error_lines = 0;
+        return;
+    }
+
+    for(auto signal:rerun_signals)
+    {
+        if(find_in(line, len, signal))
+            rerun = true;
+    }
+
+    if(starts_with(line, len, "Overfull \\hbox") || starts_with(line, len, "Overfull \\vbox"))
+    {
+        add(diag_overfull_box, std::string(line, len), number_after(line, len, "at lines "));
+        track_files(line, len);
+        return;
+    }
+
+    bool warning = starts_with(line, len, "pdfTeX warning");
+    for(auto start:warning_starts)
+    {
+        if(starts_with(line, len, start) && find_in(line, len, " Warning: "))
+            warning = true;
+    }
+    if(warning)
+    {
+        bool undefined = find_in(line, len, "undefined on input line") != NULL;
+        add(undefined ? diag_undefined_reference : diag_warning, std::string(line, len), number_after(line, len, "input line "));
+        continuing = true;
+        return;
+    }
+
+    track_files(line, len);
+}
+
+void output_parser::track_files(const char *line, size_t len)
+{
+    // TeX prints "(./chapter.tex" when it starts reading a file and ")" when it's done with it, though plenty
+    // of other brackets turn up too, so every ( is pushed and only the ones followed by a path count as files
+    for(size_t i = 0; i < len; i++)
+    {
+        if(line[i] == '(')
+        {
+            size_t start = i + 1, end = start;
+
+            while(end < len && line[end] != ' ' && line[end] != '(' && line[end] != ')')
+                end++;
+
+            if(start < len && (line[start] == '.' || line[start] == '/') && end > start + 1)
+                files.push_back(std::string(line + start, end - start));
+            else
+                files.push_back("");
+        }
+        else if(line[i] == ')' && !files.empty())
+            files.pop_back();
+    }
+}
+
+std::string output_parser::current_file() const
+{
+    for(auto file = files.rbegin(); file != files.rend(); ++file)
+    {
+        if(*file != "")
+            return file->compare(0, 2, "./") == 0 ? file->substr(2) : *file;
+    }
+    return "";
+}
+
+void output_parser::add(diagnostic_kind kind, const std::string &message, size_t line)
+{
+    diagnostic d;
+    d.kind = kind;
+    d.file = current_file();
+    d.line = line;
+    d.message = message;
+    found.push_back(d);
+}
+
+bool parse_log_file(const std::string &path, output_parser &parser)
+{
+    #ifdef SYSTEM_IS_LINUX
+    // the .log of a long document runs to megabytes, map it rather than reading it in
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    if(st.st_size > 0)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(data == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        parser.feed((const char *)data, st.st_size);
+        munmap(data, st.st_size);
+    }
+    close(fd);
+    #else
+    std::string log;
+
+    if(!read_whole_file(path, log))
+        return false;
+    parser.feed(log.data(), log.size());
+    #endif
+
+    parser.finish();
+    return true;
+}
+
+void print_diagnostics(const std::vector<diagnostic> &found)
+{
+    static const size_t max_listed = 10; // per kind, the rest are only counted
+    static const char *labels[] = {"error", "warning", "undefined reference", "overfull box"};
+    size_t counts[4] = {0, 0, 0, 0};
+
+    for(auto &d:found)
+        counts[d.kind]++;
+
+    if(found.empty())
+        return;
+
+    std::string summary;
+    for(int kind = 0; kind < 4; kind++)
+    {
+        if(counts[kind] > 0)
+            summary += (summary != "" ? ", " : "") + std::to_string(counts[kind]) + " " + labels[kind] + (counts[kind] == 1 ? "" : "s");
+    }
+    std::cout << "\nSummary: " << summary << std::endl;
+
+    // overfull boxes are rarely worth a line each, errors and undefined references always are
+    for(int kind = diag_error; kind <= diag_undefined_reference; kind++)
+    {
+        size_t listed = 0;
+
+        for(auto &d:found)
+        {
+            if(d.kind != kind || listed++ >= max_listed)
+                continue;
+
+            std::cout << "  " << (d.file != "" ? d.file : "?");
+            if(d.line > 0)
+                std::cout << ":" << d.line;
+            std::cout << ": " << labels[kind] << ": " << d.message << std::endl;
+        }
+        if(listed > max_listed)
+            std::cout << "  ... and " << listed - max_listed << " more" << std::endl;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+enum diagnostic_kind { diag_error, diag_warning, diag_undefined_reference, diag_overfull_box };
+
+// one error or warning the engine reported
+struct diagnostic
+{
+    diagnostic_kind kind;
+    std::string file;    // the source file being read at the time, as far as can be worked out from the ( and )'s
+    size_t line;         // 0 if the engine didn't say
+    std::string message;
+};
+
+// picks the errors and warnings out of engine output, either as it arrives down a pipe or from the .log
+// only lines split across two chunks are copied, everything else is parsed where it lies
+class output_parser
+{
+public:
+    output_parser();
+
+    void feed(const char *data, size_t len);
+    void finish(); // there's no more output, parse whatever is left over
+
+    bool failed() const { return fatal; } // a "! ..." error has been seen, along with where it happened
+    bool wants_rerun() const { return rerun; }
+    const std::vector<diagnostic> &diagnostics() const { return found; }
+
+private:
+    void take_line(const char *line, size_t len);
+    void parse_line(const char *line, size_t len);
+    void track_files(const char *line, size_t len);
+    std::string current_file() const;
+    void add(diagnostic_kind kind, const std::string &message, size_t line);
+
+    std::string partial;            // the start of a line whose end hasn't arrived yet
+    std::string wrapped;            // the engine breaks lines at max_print_line, this rejoins them
+    std::vector<std::string> files; // one entry per open (, "" for the ones that aren't files
+    std::vector<diagnostic> found;
+    int error_lines;                // lines since a "! ..." error started, -1 when not in one
+    bool continuing;                // the last line was a warning, which may go on over the next few lines
+    bool rerun, fatal;
+};
+
+bool parse_log_file(const std::string &path, output_parser &parser); // false if it can't be read
+void print_diagnostics(const std::vector<diagnostic> &found); // the compact summary shown after each build
+
+#endif
@@ -0,0 +1,329 @@
+#include "figures.h"
+#include "depgraph.h"
+#include "process.h"
+#include "fileutil.h"
+#include "profile.h"
+#include "metrics.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// $IN is the source, $OUT the PDF to write and $DIR the (empty) directory it goes in
+struct figure_converter
+{
+    const char *ext;
+    std::vector<std::string> argv;
+};
+
+static const figure_converter converters[] = {
+    {".eps",  {"epstopdf", "--outfile=$OUT", "$IN"}},
+    {".svg",  {"inkscape", "--export-type=pdf", "--export-filename=$OUT", "$IN"}},
+    {".puml", {"plantuml", "-tpdf", "-o", "$DIR", "$IN"}} // names the PDF after the source itself
+};
+
+static const int max_figure_age = 30 * 24 * 60 * 60; // seconds a converted figure is kept without being used
+
+// one figure the document uses, and where its PDF is kept
+struct figure
+{
+    std::string source;
+    std::string relative; // path under the document's directory, without the extension
+    const figure_converter *converter;
+    std::string cached;
+};
+
+static std::string figures_dir()
+{
+    return config_path + "figures/";
+}
+
+static std::vector<figure> find_figures(const build_job &job)
+{
+    std::vector<figure> figures;
+    std::string prefix = normalise_path(job.dir) + "/";
+
+    for(auto &dep:scan_dependencies(job.texpath))
+    {
+        size_t dotpos = dep.path.find_last_of('.');
+
+        // anything outside the document's directory is left to the engine, there is nowhere for it to go
+        if(dep.kind != ref_graphics || dotpos == std::string::npos || dep.path.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        for(auto &converter:converters)
+        {
+            uint64_t h, filehash;
+
+            if(dep.path.compare(dotpos, std::string::npos, converter.ext) != 0 || !hash_file(dep.path, filehash))
+                continue;
+
+            h = hash_string("texbuild-figure 1\n" + join_arguments(converter.argv) + "\n");
+            h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+
+            figure fig = {dep.path, dep.path.substr(prefix.size(), dotpos - prefix.size()), &converter, figures_dir() + hex64(h) + ".pdf"};
+            figures.push_back(fig);
+        }
+    }
+    return figures;
+}
+
+static bool installed(const std::string &program)
+{
+    const char *dirs = getenv("PATH");
+
+    for(auto &dir:explode(dirs ? dirs : "", ':'))
+    {
+        if(dir != "" && access(join_path(dir, program).c_str(), X_OK) == 0)
+            return true;
+    }
+    return false;
+}
+
+static pid_t start_conversion(const figure &fig, const std::string &tmpdir, const std::string &output)
+{
+    std::vector<std::string> argv;
+
+    for(auto arg:fig.converter->argv)
+    {
+        for(auto var:{std::make_pair(std::string("$IN"), fig.source), std::make_pair(std::string("$OUT"), output),
+                      std::make_pair(std::string("$DIR"), tmpdir)})
+        {
+            size_t at = arg.find(var.first);
+            if(at != std::string::npos)
+                arg.replace(at, var.first.size(), var.second);
+        }
+        argv.push_back(arg);
+    }
+
+    process_options options;
+    options.directory = parent_directory(fig.source); // figures may load files next to them
+    options.timeout = process_timeout;
+    options.output_file = join_path(tmpdir, "log");
+
+    std::cout.flush(); // otherwise the child prints whatever is still buffered a second time
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        int rc = run_process(argv, options);
+        _exit(rc < 0 ? 255 : rc);
+    }
+    return pid;
+}
+
+static void remove_directory(const std::string &dir)
+{
+    // what a converter leaves in its directory: the PDF, if it wasn't moved out, and the log
+    std::vector<std::string> files;
+    list_files(dir, "", files);
+    for(auto &file:files)
+        remove(file.c_str());
+    rmdir(dir.c_str());
+}
+
+static void run_conversions(std::vector<const figure *> &pending)
+{
+    long workers = std::min<long>(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)), pending.size());
+
+    std::cout << "Converting " << pending.size() << (pending.size() == 1 ? " figure" : " figures") << " to PDF with "
+              << workers << (workers == 1 ? " worker" : " workers") << "..." << std::endl;
+
+    // a conversion in progress, in a directory of its own so a half written PDF is never mistaken for a finished one
+    struct conversion
+    {
+        const figure *fig;
+        std::string tmpdir, output;
+    };
+
+    std::map<pid_t, conversion> running;
+    size_t next = 0;
+    int converted = 0;
+
+    while(next < pending.size() || !running.empty())
+    {
+        while((long)running.size() < workers && next < pending.size())
+        {
+            const figure *fig = pending[next++];
+            std::string tmpdir = figures_dir() + "tmp-XXXXXX";
+
+            if(!mkdtemp(&tmpdir[0]))
+                continue;
+
+            std::string name = fig->source.substr(fig->source.find_last_of('/') + 1);
+            conversion conv = {fig, tmpdir, join_path(tmpdir, name.substr(0, name.find_last_of('.')) + ".pdf")};
+            pid_t pid = start_conversion(*fig, tmpdir, conv.output);
+
+            if(pid < 0)
+            {
+                std::cout << "Error: fork() failed for '" << fig->source << "'" << std::endl;
+                remove_directory(tmpdir);
+                continue;
+            }
+            running[pid] = conv;
+        }
+
+        if(running.empty())
+            continue;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if(pid < 0 && errno != EINTR)
+            break;
+        if(pid < 0 || running.find(pid) == running.end())
+            continue;
+
+        conversion conv = running[pid];
+        int rc = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        running.erase(pid);
+
+        if(rc == 0 && file_exists(conv.output) && rename(conv.output.c_str(), conv.fig->cached.c_str()) == 0)
+            converted++;
+        else
+        {
+            // tried, it didn't work, and it won't until the figure changes
+            std::string log;
+            read_whole_file(join_path(conv.tmpdir, "log"), log);
+            std::cout << "Warning: could not convert '" << conv.fig->source << "' to PDF, leaving it to the engine\n" << log << std::endl;
+            std::ofstream(conv.fig->cached + ".failed") << rc << "\n";
+        }
+        remove_directory(conv.tmpdir);
+    }
+
+    std::cout << "Converted " << converted << (converted == 1 ? " figure" : " figures") << "\n" << std::endl;
+}
+
+static bool place_figure(const std::string &cached, const std::string &target)
+{
+    struct stat a, b;
+
+    if(stat(cached.c_str(), &a) == 0 && stat(target.c_str(), &b) == 0)
+    {
+        uint64_t ha, hb;
+
+        if(a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+            return true; // linked there by an earlier build
+        if(a.st_size == b.st_size && hash_file(cached, ha) && hash_file(target, hb) && ha == hb)
+            return true; // or copied
+    }
+
+    // a link where it can be, the output directory may be on another filesystem though (--auxdir)
+    std::string tmp = target + ".texbuild-tmp", contents;
+
+    make_directories(parent_directory(target));
+    remove(tmp.c_str());
+    if(link(cached.c_str(), tmp.c_str()) != 0)
+    {
+        std::ofstream ofile(tmp, std::ios::binary);
+
+        if(!read_whole_file(cached, contents) || !(ofile << contents))
+            return false;
+        ofile.close();
+        if(ofile.fail())
+            return false;
+    }
+    return rename(tmp.c_str(), target.c_str()) == 0;
+}
+
+static void prune_figures()
+{
+    std::vector<std::string> files;
+    time_t now = time(NULL);
+
+    list_files(figures_dir(), ".pdf", files);
+    list_files(figures_dir(), ".failed", files);
+    for(auto &file:files)
+    {
+        struct stat st;
+        if(stat(file.c_str(), &st) == 0 && now - st.st_mtime > max_figure_age)
+            remove(file.c_str());
+    }
+}
+
+std::string convert_figures(const build_job &job)
+{
+    profile_scope scope("convert figures", "figures");
+
+    std::vector<figure> figures = find_figures(job);
+    std::string figuredir = join_path(job.outdir, ".figures");
+    std::vector<const figure *> pending;
+
+    scope.arg("figures", std::to_string(figures.size()));
+    if(figures.empty())
+        return "";
+
+    std::set<std::string> missing; // converters that aren't installed, each only mentioned once
+
+    for(auto &fig:figures)
+    {
+        const std::string &program = fig.converter->argv[0];
+
+        if(file_exists(fig.cached) || file_exists(fig.cached + ".failed"))
+            continue;
+
+        if(installed(program))
+            pending.push_back(&fig);
+        else if(missing.insert(program).second)
+            std::cout << "Warning: '" << program << "' isn't installed, leaving the " << fig.converter->ext << " figures to the engine" << std::endl;
+    }
+
+    if(!pending.empty() && make_directories(figures_dir()))
+    {
+        metrics_timer timer;
+        run_conversions(pending);
+        timer.record("figures");
+        prune_figures();
+    }
+
+    // graphicx looks for a.pdf first when it isn't told the extension, epstopdf for a-eps-converted-to.pdf when it is
+    std::set<std::string> placed;
+
+    for(auto &fig:figures)
+    {
+        std::vector<std::string> names(1, fig.relative + ".pdf");
+        if(std::string(fig.converter->ext) == ".eps")
+            names.push_back(fig.relative + "-eps-converted-to.pdf");
+
+        if(!file_exists(fig.cached))
+            continue;
+        utime(fig.cached.c_str(), NULL); // keeps it from being pruned
+
+        for(auto &name:names)
+        {
+            std::string target = join_path(figuredir, name);
+
+            if(place_figure(fig.cached, target))
+                placed.insert(target);
+            else
+                std::cout << "Warning: could not put the converted '" << fig.source << "' in '" << target << "'" << std::endl;
+        }
+    }
+
+    // a figure that has since been removed, or replaced by a .png, mustn't still be found here
+    std::vector<std::string> old;
+    list_files(figuredir, ".pdf", old);
+    for(auto &path:old)
+    {
+        if(!placed.count(path))
+            remove(path.c_str());
+    }
+
+    return placed.empty() ? "" : figuredir;
+}
+
+#endif
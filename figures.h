@@ -0,0 +1,19 @@
+#ifndef FIGURES_H
+#define FIGURES_H
+
+#include "texbuild.h"
+
+#include <string>
+
+#ifdef SYSTEM_IS_LINUX
+// .eps, .svg and PlantUML figures the document \includegraphics's, converted to PDF before the engine runs rather than
+// one at a time through shell escape during it. conversions run alongside each other, one per core, and are kept in
+// config_path/figures/<hash of the converter and the source>.pdf, so an unchanged figure is never converted twice.
+// the results are linked into <outdir>/.figures under the figure's path relative to the document, which the engine
+// searches through TEXINPUTS, so \includegraphics{plots/a} finds .figures/plots/a.pdf before it goes looking for a.eps
+
+// returns the directory for TEXINPUTS, empty if the document has no figures to convert
+std::string convert_figures(const build_job &job);
+#endif
+
+#endif
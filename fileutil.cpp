@@ -0,0 +1,259 @@
+#include "texbuild.h"
+#include "fileutil.h"
+
+#include <fstream>
+#include <string_view>
+#include <iterator>
+#include <set>
+#include <cstdio>
+#include <cerrno>
+
+#ifdef SYSTEM_IS_LINUX
+    #include <sys/stat.h>
+    #include <dirent.h>
+    #include <limits.h>
+    #include <stdlib.h>
+#endif
+
+uint64_t hash_bytes(const char *data, size_t len, uint64_t h)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL; // FNV prime
+    }
+    return h;
+}
+
+uint64_t hash_string(const std::string &s, uint64_t h)
+{
+    return hash_bytes(s.data(), s.size(), h);
+}
+
+bool hash_file(const std::string &path, uint64_t &h)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+
+    if(!f)
+        return false;
+
+    char buffer[65536];
+    size_t n;
+
+    h = hash_seed;
+    while((n = fread(buffer, 1, sizeof buffer, f)) > 0)
+        h = hash_bytes(buffer, n, h);
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+std::string hex64(uint64_t h)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof buffer, "%016llx", (unsigned long long)h);
+    return buffer;
+}
+
+std::string job_key(const build_job &job)
+{
+    // the variants of one master run at the same time, so each keeps its own cache, stamps and lock
+    return hex64(hash_string(job.texpath)) + (job.variant != "" ? "-" + job.variant : "");
+}
+
+bool parse_hex64(const std::string &s, uint64_t &h)
+{
+    if(s.size() != 16)
+        return false;
+
+    h = 0;
+    for(char c:s)
+    {
+        h <<= 4;
+        if(c >= '0' && c <= '9')
+            h |= c - '0';
+        else if(c >= 'a' && c <= 'f')
+            h |= c - 'a' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+bool read_whole_file(const std::string &path, std::string &contents)
+{
+    std::ifstream ifile(path, std::ios::binary);
+
+    if(!ifile.good())
+        return false;
+
+    // in large blocks rather than a byte at a time through the iterators, which costs more than the scans that follow.
+    // until EOF rather than by the size it reports, /proc files say they're empty
+    char buffer[65536];
+
+    contents.clear();
+    while(ifile.read(buffer, sizeof buffer) || ifile.gcount() > 0)
+        contents.append(buffer, ifile.gcount());
+    return true;
+}
+
+bool make_directories(const std::string &path)
+{
+    #ifdef SYSTEM_IS_LINUX
+    // create every missing directory along the way, one slash at a time
+    for(size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+    {
+        std::string part = path.substr(0, pos);
+
+        if(part != "" && mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+
+        if(pos == std::string::npos)
+            break;
+    }
+    return true;
+    #elif defined(SYSTEM_IS_WINDOWS)
+    for(size_t pos = path.find('/', 3); ; pos = path.find('/', pos + 1))
+    {
+        CreateDirectory(path.substr(0, pos).c_str(), NULL);
+
+        if(pos == std::string::npos)
+            break;
+    }
+    return true;
+    #endif
+}
+
+std::string parent_directory(const std::string &path)
+{
+    size_t slashpos = path.find_last_of('/');
+
+    if(slashpos == std::string::npos)
+        return "";
+    return path.substr(0, slashpos);
+}
+
+std::string join_path(const std::string &dir, const std::string &name)
+{
+    if(name != "" && name[0] == '/') // already absolute
+        return name;
+    if(dir == "")
+        return name;
+    if(dir.back() == '/')
+        return dir + name;
+    return dir + "/" + name;
+}
+
+std::string normalise_path(const std::string &path)
+{
+    // collapses "." and "dir/.." without touching the filesystem, so /a/b/../c.tex and /a/c.tex compare equal
+    // one pass straight into the result, this runs on every link of a master= chain
+    std::string result = path != "" && path[0] == '/' ? "/" : "";
+    size_t root = result.size(), parts = 0, ups = 0; // ups are leading ".." parts, which can't be collapsed
+
+    result.reserve(path.size());
+
+    for(size_t start = 0, end; start < path.size(); start = end + 1)
+    {
+        end = path.find('/', start);
+        if(end == std::string::npos)
+            end = path.size();
+
+        std::string_view part(path.data() + start, end - start);
+
+        if(part.empty() || part == ".")
+            continue;
+        if(part == ".." && parts > ups)
+        {
+            size_t slash = result.rfind('/');
+            result.erase(slash == std::string::npos || slash < root ? root : slash);
+            parts--;
+            continue;
+        }
+
+        if(part == "..")
+            ups++;
+        if(result.size() > root)
+            result += '/';
+        result.append(part.data(), part.size());
+        parts++;
+    }
+    return result;
+}
+
+std::string absolute_path(const std::string &path)
+{
+    #ifdef SYSTEM_IS_LINUX
+    char buffer[PATH_MAX];
+
+    if(realpath(path.c_str(), buffer) != NULL)
+        return buffer;
+    #endif
+    return path;
+}
+
+#ifdef SYSTEM_IS_LINUX
+static void walk_directories(const std::string &dir, const std::string &ext, std::vector<std::string> *files, std::vector<std::string> *dirs,
+                             std::set<std::pair<dev_t, ino_t> > &visited)
+{
+    DIR *d = opendir(dir.c_str());
+
+    if(!d)
+        return;
+
+    struct dirent *entry;
+    while((entry = readdir(d)) != NULL)
+    {
+        std::string name = entry->d_name;
+
+        if(name[0] == '.') // ., .. and hidden files/directories like .git
+            continue;
+
+        std::string path = join_path(dir, name);
+        struct stat st;
+
+        if(stat(path.c_str(), &st) != 0)
+            continue;
+
+        if(S_ISDIR(st.st_mode))
+        {
+            // symlinked directories are followed, but only once, a link back up the tree would otherwise never end
+            if(!visited.insert(std::make_pair(st.st_dev, st.st_ino)).second)
+                continue;
+            if(dirs)
+                dirs->push_back(path);
+            walk_directories(path, ext, files, dirs, visited);
+        }
+        else if(files && name.size() > ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0)
+        {
+            files->push_back(path);
+        }
+    }
+    closedir(d);
+}
+
+void list_files(const std::string &dir, const std::string &ext, std::vector<std::string> &files)
+{
+    std::set<std::pair<dev_t, ino_t> > visited;
+    struct stat st;
+
+    if(stat(dir.c_str(), &st) == 0)
+        visited.insert(std::make_pair(st.st_dev, st.st_ino));
+    walk_directories(dir, ext, &files, NULL, visited);
+}
+
+void mirror_directories(const std::string &from, const std::string &to, const std::vector<std::string> &files)
+{
+    std::string prefix = normalise_path(from) + "/";
+
+    for(auto &file:files)
+    {
+        std::string path = normalise_path(file);
+
+        // anything outside from has nowhere to go under to
+        if(path.compare(0, prefix.size(), prefix) == 0)
+            make_directories(join_path(to, parent_directory(path.substr(prefix.size()))));
+    }
+}
+#endif
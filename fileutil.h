@@ -0,0 +1,36 @@
+#ifndef FILEUTIL_H
+#define FILEUTIL_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// 64 bit FNV-1a, good enough for spotting changed files, not for anything security related
+const uint64_t hash_seed = 14695981039346656037ULL;
+
+uint64_t hash_bytes(const char *data, size_t len, uint64_t h = hash_seed);
+uint64_t hash_string(const std::string &s, uint64_t h = hash_seed);
+bool hash_file(const std::string &path, uint64_t &h); // false if the file can't be read
+
+std::string hex64(uint64_t h);
+bool parse_hex64(const std::string &s, uint64_t &h);
+
+std::string job_key(const build_job &job); // names the job's files under config_path, the master's hash and any variant
+
+bool read_whole_file(const std::string &path, std::string &contents);
+bool make_directories(const std::string &path); // like mkdir -p
+
+std::string parent_directory(const std::string &path); // everything before the last slash
+std::string join_path(const std::string &dir, const std::string &name);
+std::string normalise_path(const std::string &path); // removes . and .. components
+std::string absolute_path(const std::string &path); // the path unchanged if it can't be resolved
+
+#ifdef SYSTEM_IS_LINUX
+void list_files(const std::string &dir, const std::string &ext, std::vector<std::string> &files); // recursive, skips hidden directories
+void mirror_directories(const std::string &from, const std::string &to, const std::vector<std::string> &files); // recreate in to the directories these files under from are in
+#endif
+
+#endif
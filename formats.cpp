@@ -0,0 +1,275 @@
+#include "formats.h"
+#include "cache.h"
+#include "process.h"
+#include "fileutil.h"
+#include "profile.h"
+#include "metrics.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// engines mylatexformat works with, lualatex can't dump the Lua side of its state
+static const char *format_engines[] = {"pdflatex", "xelatex", "latex"};
+
+// formats are tens of megabytes each and every edit to a preamble makes a new one, keep the most recently used few
+static const size_t max_formats = 8;
+
+static std::string formats_dir()
+{
+    return config_path + "formats/";
+}
+
+static std::string engine_name(const build_job &job)
+{
+    std::string engine = job.comp_argv[0];
+    return engine.substr(engine.find_last_of('/') + 1);
+}
+
+static bool split_preamble(const std::string &texpath, std::string &preamble)
+{
+    // everything before \begin{document}, or before \endofdump if the document marks where mylatexformat should stop
+    std::ifstream ifile(texpath);
+    std::string line;
+
+    while(getline(ifile, line))
+    {
+        size_t comment = 0;
+        while((comment = line.find('%', comment)) != std::string::npos && comment > 0 && line[comment - 1] == '\\')
+            comment++;
+
+        std::string code = line.substr(0, comment);
+        size_t cut = std::min(code.find("\\begin{document}"), code.find("\\endofdump"));
+
+        if(cut != std::string::npos)
+        {
+            preamble += code.substr(0, cut);
+            return true;
+        }
+        preamble += line + "\n";
+    }
+    return false;
+}
+
+static std::vector<std::string> format_options(const build_job &job)
+{
+    // the options the document is compiled with, less those that are about this particular run rather than the preamble
+    static const char *run_options[] = {"-output-directory=", "-aux-directory=", "-jobname=", "-recorder", "-halt-on-error"};
+    std::vector<std::string> options;
+
+    for(size_t i = 1; i + 1 < job.comp_argv.size(); i++)
+    {
+        bool keep = true;
+
+        for(auto option:run_options)
+        {
+            if(job.comp_argv[i].find(option) != std::string::npos)
+                keep = false;
+        }
+        if(keep)
+            options.push_back(job.comp_argv[i]);
+    }
+    return options;
+}
+
+static bool inputs_unchanged(const std::string &name, std::vector<std::string> &inputs)
+{
+    // <name>.deps lists the project's own files the preamble loaded, "<hash> <path>"
+    std::ifstream ifile(formats_dir() + name + ".deps");
+    std::string line;
+
+    if(!ifile)
+        return false;
+
+    while(getline(ifile, line))
+    {
+        uint64_t recorded, current;
+
+        if(line.size() < 18 || !parse_hex64(line.substr(0, 16), recorded))
+            return false;
+
+        std::string path = line.substr(17);
+        if(!hash_file(path, current) || current != recorded)
+        {
+            std::cout << "'" << path << "' has changed since the preamble was precompiled" << std::endl;
+            return false;
+        }
+        inputs.push_back(path);
+    }
+    return true;
+}
+
+static void prune_formats()
+{
+    std::vector<std::string> formats;
+    std::vector<std::pair<time_t, std::string> > byage;
+
+    list_files(formats_dir(), ".fmt", formats);
+
+    for(auto &fmt:formats)
+    {
+        struct stat st;
+        if(stat(fmt.c_str(), &st) == 0)
+            byage.push_back(std::make_pair(st.st_mtime, fmt));
+    }
+    if(byage.size() <= max_formats)
+        return;
+
+    std::sort(byage.rbegin(), byage.rend()); // most recently used first
+
+    for(size_t i = max_formats; i < byage.size(); i++)
+    {
+        std::string base = byage[i].second.substr(0, byage[i].second.size() - 4);
+
+        for(auto ext:{".fmt", ".deps", ".log", ".lock"})
+            remove((base + ext).c_str());
+    }
+}
+
+static bool build_format(const build_job &job, const std::string &name, std::vector<std::string> &inputs)
+{
+    std::string dir = formats_dir();
+
+    // mylatexformat reads the document as far as \begin{document} and dumps everything it has loaded by then
+    std::vector<std::string> argv = {job.comp_argv[0], "-ini", "-interaction=batchmode", "-halt-on-error", "-recorder",
+                                     "-jobname=" + name, "-output-directory=" + dir};
+    for(auto &option:format_options(job))
+        argv.push_back(option);
+    argv.push_back("&" + engine_name(job));
+    argv.push_back("mylatexformat.ltx");
+    // a variant's TeX comes before the preamble and may change what it loads, so it goes in through the wrapper
+    argv.push_back("\"" + (job.prelude != "" ? job.comp_argv.back() : job.texpath) + "\"");
+
+    process_options options;
+    options.directory = job.dir; // local packages are found relative to the document, just like in a normal run
+    options.timeout = process_timeout;
+    options.output_file = "/dev/null"; // batchmode, everything worth seeing is in the .log
+
+    std::cout << "Precompiling the preamble..." << std::endl;
+
+    metrics_timer timer;
+    int rc = run_process(argv, options);
+    timer.record("format");
+
+    if(rc != 0 || !file_exists(dir + name + ".fmt"))
+    {
+        std::cout << "Warning: could not precompile the preamble (see '" << dir << name << ".log'), compiling normally\n" << std::endl;
+        std::ofstream(dir + name + ".failed") << rc << "\n";
+        remove((dir + name + ".fls").c_str());
+        return false;
+    }
+
+    // remember which of the project's files went into it, a change to a local .sty needs a new format
+    std::ofstream ofile(dir + name + ".deps.tmp");
+
+    for(auto &path:read_fls_inputs(dir + name + ".fls", job.dir))
+    {
+        uint64_t h;
+
+        if(path != job.texpath && path != job.comp_argv.back() && hash_file(path, h))
+        {
+            ofile << hex64(h) << " " << path << "\n";
+            inputs.push_back(path);
+        }
+    }
+    ofile.close();
+    rename((dir + name + ".deps.tmp").c_str(), (dir + name + ".deps").c_str());
+    remove((dir + name + ".fls").c_str());
+
+    prune_formats();
+    return true;
+}
+
+bool use_precompiled_preamble(build_job &job)
+{
+    profile_scope scope("precompiled preamble", "format");
+
+    if(!precompile_preamble || job.comp_argv.empty())
+        return false;
+
+    std::string engine = engine_name(job);
+    if(std::find(std::begin(format_engines), std::end(format_engines), engine) == std::end(format_engines))
+        return false;
+
+    for(size_t i = 1; i + 1 < job.comp_argv.size(); i++)
+    {
+        const std::string &arg = job.comp_argv[i];
+
+        if(arg.find("-fmt") != std::string::npos || arg.find("-ini") != std::string::npos || arg[0] == '&')
+            return false; // the user has their own format in mind
+    }
+
+    std::string preamble;
+    if(!split_preamble(job.texpath, preamble))
+        return false;
+
+    // local packages are looked up relative to the document, so the same preamble elsewhere may load different files
+    uint64_t h = hash_string("texbuild-format 1\n" + engine + "\n" + job.dir + "\n");
+    for(auto &option:format_options(job))
+        h = hash_string(option + "\n", h);
+    h = hash_string(preamble, h);
+    h = hash_string(job.prelude, h); // nothing for the master as it is, variants with the same TeX share a format
+
+    std::string name = hex64(h), dir = formats_dir();
+
+    if(file_exists(dir + name + ".failed"))
+        return false; // tried before, it didn't work then either
+
+    if(!make_directories(dir))
+        return false;
+
+    // batch mode may build several documents with the same preamble at once, only one of them should dump it
+    int lockfd = open((dir + name + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(lockfd >= 0)
+        flock(lockfd, LOCK_EX);
+
+    std::vector<std::string> inputs;
+    bool ready = file_exists(dir + name + ".fmt") && inputs_unchanged(name, inputs);
+
+    if(!ready)
+    {
+        inputs.clear();
+        ready = build_format(job, name, inputs);
+    }
+
+    if(lockfd >= 0)
+        close(lockfd);
+
+    if(!ready)
+        return false;
+
+    utime((dir + name + ".fmt").c_str(), NULL); // keeps it from being pruned
+
+    std::cout << "Using the precompiled preamble '" << dir << name << ".fmt'" << std::endl;
+    job.comp_argv.insert(job.comp_argv.begin() + 1, "-fmt=" + dir + name);
+    job.preamble_inputs = inputs;
+    return true;
+}
+
+bool format_rejected(const build_job &job)
+{
+    std::string log, prefix = "-fmt=" + formats_dir();
+
+    if(job.comp_argv.size() < 2 || job.comp_argv[1].compare(0, prefix.size(), prefix) != 0)
+        return false;
+
+    // e.g. after the TeX installation has been updated, the format has to be made by the same engine binary
+    read_whole_file(join_path(job.outdir, job.jobname + ".log"), log);
+    if(log.find("Fatal format file error") == std::string::npos)
+        return false;
+
+    std::string path = job.comp_argv[1].substr(5);
+    std::ofstream(path + ".failed") << "rejected\n";
+    remove((path + ".fmt").c_str());
+    return true;
+}
+
+#endif
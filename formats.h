@@ -0,0 +1,20 @@
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include "texbuild.h"
+
+#include <string>
+
+#ifdef SYSTEM_IS_LINUX
+// precompiled preambles, everything before \begin{document} dumped to config_path/formats/<hash>.fmt with
+// mylatexformat and loaded with -fmt= instead of being read again on every run
+
+// points the engine at the format for the job's preamble, building it first if there isn't one yet
+// false (and the job untouched) if the engine can't dump formats or the build failed, compile normally then
+bool use_precompiled_preamble(build_job &job);
+
+// true if the engine refused the format after a failed build, which is then never offered again
+bool format_rejected(const build_job &job);
+#endif
+
+#endif
@@ -1,12 +1,24 @@
-#ifdef __linux__
-    #define SYSTEM_IS_LINUX // uncomment if using on a Linux system
-    #include <unistd.h>
-    #include <sys/types.h>
-    #include <pwd.h>
-#elif defined(_WIN32)
-    #define SYSTEM_IS_WINDOWS // uncomment if using on a Windows system
-    #include <windows.h>
-#endif
+#include "texbuild.h"
+#include "cache.h"
+#include "passes.h"
+#include "batch.h"
+#include "depgraph.h"
+#include "watch.h"
+#include "process.h"
+#include "viewer.h"
+#include "formats.h"
+#include "daemon.h"
+#include "profile.h"
+#include "specifiers.h"
+#include "masterindex.h"
+#include "auxdir.h"
+#include "store.h"
+#include "masterlock.h"
+#include "variants.h"
+#include "figures.h"
+#include "metrics.h"
+#include "preflight.h"
+#include "fileutil.h"
 
 #include <iostream>
 #include <fstream>
@@ -14,6 +26,7 @@
 #include <vector>
 #include <algorithm>
 #include <stdlib.h>
+#include <signal.h>
 
 std::string config_path;
 
@@ -35,7 +48,24 @@ std::string config_path;
 */
 const char *version = "1.5.3";
 
-std::string dont_use_specvalue = "none"; // this value in a specifier-value pair indicates that the default value should not be used
+bool incremental_build = false; // if true, documents are only recompiled when something they read has changed (can also be set with --incremental)
+bool force_build = false; // if true, the incremental build cache is ignored for this run (set with --force)
+bool watch_mode = false; // if true, keep rebuilding whenever a source file changes (set with --watch)
+int process_timeout = 0; // seconds before a hung engine or bib engine is killed, 0 for never (set with --timeout=)
+int watch_debounce_ms = 200; // how long to wait for a burst of saves to finish before rebuilding (set with --debounce=)
+std::string output_root; // if set, each document's output goes in its own directory under here (set with --outdir=)
+std::string aux_root; // if set, each document's intermediate files stay in a directory of their own under here (set with --auxdir or --auxdir=)
+std::string store_root; // if set, builds are looked up in and saved to a store of outputs here (set with --store or --store=)
+std::string shared_store; // a second store, looked in after the local one and saved to as well (set with --shared-store=)
+long store_limit_mb = 4096; // the least recently used builds leave the local store once it gets bigger (set with --store-limit=)
+long aux_root_limit_mb = 1024; // the least recently used of those directories go once they add up to more (set with --auxdir-limit=)
+bool profile_build = false; // if true, time each phase of the build and write a trace (set with --profile or --profile=FILE)
+std::string profile_file; // where the trace goes, next to the output if not set
+bool precompile_preamble = true; // if true, the preamble is dumped to a format once and reused until it changes (turn off with --no-format)
+bool focus_build = false; // if true, a file \include'd by its master builds only that file (set with --focus, or focus=yes on the master)
+bool draft_passes = true; // if true, passes that are certain not to be the last skip writing the output (turn off with --no-draft)
+bool preconvert_figures = true; // if true, .eps, .svg and PlantUML figures are converted to PDF in parallel before the engine runs (turn off with --no-figures)
+bool preflight_build = false; // if true, the sources are checked for unbalanced braces, environments and math before the engine runs (set with --preflight)
 
 #ifndef USE_CONFIG_FILE_DEFAULTS // don't change this line
 
@@ -55,6 +85,12 @@ std::string default_outoptions;
 std::string default_openwith   = "C:\\Program Files\\SumatraPDF\\SumatraPDF.exe";
 std::string default_outoptions = "-reuse-instance";
 #endif
+std::string default_maxpasses  = "5";
+std::string default_index;
+std::string default_glossary;
+std::string default_nomencl;
+std::string default_focus      = "no";
+std::string default_variants;
 
 //=============================================================================================================
 //=============================================================================================================
@@ -62,14 +98,22 @@ std::string default_outoptions = "-reuse-instance";
 
 #else
 
-std::string default_master, default_engine, default_options, default_bib, default_biboptions, default_outext, default_openwith, default_outoptions;
+bool refresh_viewer = false;
+
+std::string default_master, default_engine, default_options, default_bib, default_biboptions, default_outext, default_openwith, default_outoptions, default_maxpasses;
+std::string default_index, default_glossary, default_nomencl, default_focus, default_variants;
 
 #endif
 
 void read_config_file()
 {
+    // the same keys as the first line, one key=value per line, an empty value meaning no default
+    std::string *defaults[specifier_key_count] = {&default_master, &default_engine, &default_bib, &default_options, &default_biboptions,
+                                                  &default_outext, &default_openwith, &default_outoptions, &default_maxpasses,
+                                                  &default_index, &default_glossary, &default_nomencl, &default_focus, &default_variants}; // in specifier_key order
     std::ifstream ifile;
     std::string line;
+    int number = 0;
 
     ifile.open("config.txt");
 
@@ -77,208 +121,177 @@ void read_config_file()
 
     while(getline(ifile, line))
     {
-        if(line.substr(0, 7) == "master=")
-        {
-            default_master = line.substr(7);
-            std::cout << "Default for master set to " << default_master << std::endl;
-        }
-        else if(line.substr(0, 7) == "engine=")
-        {
-            default_engine = line.substr(7);
-            std::cout << "Default for engine set to " << default_engine << std::endl;
-        }
-        else if(line.substr(0, 8) == "options=")
-        {
-            default_options = line.substr(8);
-            std::cout << "Default for options set to " << default_options << std::endl;
-        }
-        else if(line.substr(0, 4) == "bib=")
-        {
-            default_bib = line.substr(4);
-            std::cout << "Default for bib set to " << default_bib << std::endl;
-        }
-        else if(line.substr(0, 11) == "biboptions=")
-        {
-            default_biboptions = line.substr(11);
-            std::cout << "Default for biboptions set to " << default_biboptions << std::endl;
-        }
-        else if(line.substr(0, 7) == "outext=")
-        {
-            default_outext = line.substr(7);
-            std::cout << "Default for outext set to " << default_outext << std::endl;
-        }
-        else if(line.substr(0, 9) == "openwith=")
-        {
-            default_openwith = line.substr(9);
-            std::cout << "Default for openwith set to " << default_openwith << std::endl;
-        }
-        else if(line.substr(0, 11) == "outoptions=")
+        number++;
+
+        std::string_view text = trim_whitespace(line);
+        if(text.empty())
+            continue;
+
+        size_t equals = text.find('=');
+        const specifier_info *info = equals == std::string_view::npos ? NULL : find_specifier(trim_whitespace(text.substr(0, equals)));
+
+        if(info == NULL)
         {
-            default_outoptions = line.substr(11);
-            std::cout << "Default for outoptions set to " << default_outoptions << std::endl;
+            std::cout << "I don't know what '" << text << "' on line " << number << " means" << std::endl;
+            continue;
         }
-        else
+
+        std::string_view value = trim_whitespace(text.substr(equals + 1));
+        const char *problem = value.empty() ? NULL : check_specifier(*info, value);
+
+        if(problem)
         {
-            std::cout << "I don't know what '" << line << "' means" << std::endl;
+            std::cout << "Warning: " << info->name << "= on line " << number << " " << problem << ", ignoring it" << std::endl;
+            continue;
         }
+
+        defaults[info->key]->assign(value);
+        std::cout << "Default for " << info->name << " set to " << *defaults[info->key] << std::endl;
     }
     std::cout << std::endl;
 
     ifile.close();
 }
 
-void sanitise_path(std::string &path)
+#ifdef SYSTEM_IS_LINUX
+// the build itself, which leaves everything in job.outdir
+static int build_in_outdir(const build_job &job, bool *skipped)
 {
-    /*
-    Both CreateProcess for windows and Unix-like systems prefer a forward slash (/) instead of a backslash (\) as a separator in file paths
-    this function replaces all forward slashes in a string with backslashes
-    */
-    std::string adjusted_path; // stores new path
+    if(skipped)
+        *skipped = false;
 
-    for(auto c:path) // for every character in the given path
-    {
-        if (c == '\\') // if that character is a forward slash
-            adjusted_path += "/"; // add a backslash to the new path instead (\\ is the control character for backslash in an std::string or char *)
-        else
-            adjusted_path += c; // otherwise add character to new path
-    }
-    // removes any troublesome double slashes
-    if(adjusted_path.size() > 0)
+    if(job.outdir != job.dir)
     {
-        for(unsigned int i = 0; i < adjusted_path.size() - 1; i++)
-        {
-            if(adjusted_path.substr(i, 2) == "//")
-            {
-                adjusted_path.replace(i, 2, "/");
-            }
-        }
+        // the engine won't create the output directory, nor the subdirectories \include'd files write their .aux to
+        std::vector<std::string> included;
+
+        for(auto &dep:scan_dependencies(job.texpath))
+            if(dep.kind == ref_include)
+                included.push_back(dep.path);
+        make_directories(job.outdir);
+        mirror_directories(job.dir, job.outdir, included);
     }
 
-    path = adjusted_path; // set path to new path
-}
+    // ahead of the cache check, a changed figure changes the PDF the last build read
+    std::string figuredir = preconvert_figures && job.outext == ".pdf" ? convert_figures(job) : "";
 
-inline bool file_exists(const std::string name)
-{
-    // checks if a file exists
-    std::ifstream f(name.c_str());
-    return f.good();
-}
+    double check_start = profile_now();
+    bool fresh = incremental_build && cache_is_fresh(job);
+    profile_record("check build cache", "cache", check_start, profile_now(), {{"fresh", fresh ? "yes" : "no"}});
 
-std::vector<std::string> explode(std::string s, char c)
-{
-    /*
-    splits a string on c
-    for example, explode("list,of,words",',') returns {"list","of","words"}
-    function ignores any instances of c inside double quotes
-    */
-
-	std::string buffer; // stores current word
-	std::vector<std::string> v; // output
-	bool track = true; // keeps track of whether the loop is in a double quote pair or not
-
-	for(auto n:s) // iterate through s
-	{
-	    if(n == '"')
-            track = !track; // we have just entered/left a quote pair
-	    if(!track)
-        {
-            buffer += n; // if in quote pair, add n to buffer regardless
-            continue; // skip any further comparisons
-        }
-		if(n != c)
-            buffer += n; // if n is not c, add to buffer
-        else if(n == c && buffer != "" && track)
-        {
-            v.push_back(buffer); // if n is c, add buffer to output
-            buffer = ""; // reset buffer
-        }
-	}
-	if(buffer !=  "") // if there is something in the buffer
-        v.push_back(buffer); // add whatever buffer is to output
-
-	return v;
-}
-
-void eliminate_whitespace(std::string &str)
-{
-    std::string s;
-    bool eliminate = true;
-
-    for(auto c:str)
+    if(fresh)
     {
-        if(c == '=') // stop removing whitespace
-            eliminate = false;
-        else if(c == ';') // start removing whitespace again
-            eliminate = true;
-
-        if(!(c == ' ' && eliminate))
-            s += c; // if char is not whitespace, add to buffer string
+        // nothing the last build read has changed, so the output already on disk is up to date
+        std::cout << "Nothing has changed since the last build, skipping compilation\n" << std::endl;
+        if(skipped)
+            *skipped = true;
+        return 0;
     }
 
-    str = s;
-}
-
-std::string mod_abs_path(std::string abspath, std::string relpath)
-{
-    // abspath must have a '\' at the end
-    while(relpath.substr(0,3) == "../") // if relative path has 'go up a level', go up a level
+    if((store_root != "" || shared_store != "") && store_fetch(job))
     {
-        size_t pos = abspath.find_last_of('/', abspath.size() - 2);
+        // the .fls came with it, with this checkout's paths put back in, so the cache and the graph carry on as usual
+        if(incremental_build)
+            cache_store(job);
+        update_dependency_graph(job.texpath, scan_dependencies(job.texpath));
+        return 0;
+    }
+
+    // the same job, but loading the preamble from a precompiled format when there is one
+    build_job run = job;
+    run.figuredir = figuredir;
+    bool formatted = use_precompiled_preamble(run);
 
-        abspath.erase(abspath.begin()+pos, abspath.end() - 1); // by deleting the last part of the absolute path
+    // runs the engine as many times as the document needs, and the bib engine only when citations changed
+    int rc = run_passes(run);
 
-        relpath.erase(0,3); // remove the up one level specifier
+    if(rc != 0 && formatted && !stop_requested && format_rejected(run))
+    {
+        std::cout << "\nThe engine refused the precompiled preamble, compiling normally\n" << std::endl;
+        run = job;
+        run.figuredir = figuredir;
+        rc = run_passes(run);
     }
-    std::string buffer = abspath + relpath; // add the relative path to the absolute path
-    return buffer;
-}
 
-#ifdef SYSTEM_IS_LINUX
-std::string modify_for_grep(std::string pdfid, int outopts_size)
-{
-    std::string output;
+    if(rc == 0 && incremental_build)
+        cache_store(run); // remember what this build read so the next one can be skipped
 
-    pdfid = pdfid.erase(pdfid.size() - outopts_size);
+    if(rc == 0 && (store_root != "" || shared_store != ""))
+        store_save(run); // for identical builds elsewhere
 
-    for(char c:pdfid)
+    if(rc == 0)
     {
-        if(c != '"') output += c;
+        profile_scope updating("update dependency graph", "depgraph");
+        update_dependency_graph(job.texpath, scan_dependencies(job.texpath)); // keeps texbuild --affected up to date
     }
-    while(output.back() == ' ')
-        output.pop_back();
 
-    output.insert(1, "]");
-    output = "ps ax | grep \"[" + output + "\"";
-    return output;
+    return rc;
 }
-
-std::string get_stdout(FILE * pFile)
+int compile_document(const build_job &job, bool *skipped)
 {
-    char buffer[256];
-    std::string filecontents;
+    // everything between the commands being assembled and the output being opened, shared with batch mode
+    // a missing brace fails here in milliseconds rather than once the engine has loaded the preamble, once for all variants
+    if(preflight_build && job.variant == "" && !preflight_sources(job))
+        return 1;
+
+    if(!job.variants.empty())
+        return build_variants(job, skipped);
 
-    if(!pFile)
+    // two builds of one master at once would write over each other's .aux, so wait for (or stop) any other first
+    bool joined = false;
+    int rc = 0;
+    int lockfd = lock_master(job, joined, rc);
+
+    if(joined)
     {
-        std::cout << "popen() failed" << std::endl;
-        return "";
+        std::cout << "It has finished, nothing left to build\n" << std::endl;
+        if(skipped)
+            *skipped = true;
+        return rc;
     }
-    while(!feof(pFile))
+
+    metrics_begin(); // what this build does is timed from here, and recorded once it's over
+
+    // with --auxdir the intermediate files are kept from the last run, and nothing may evict them mid-build
+    int auxfd = -1;
+    if(job.publishdir != "" && (auxfd = claim_aux_dir(job)) < 0)
     {
-        if(fgets(buffer, 256, pFile) != NULL)
-            filecontents += buffer;
+        std::cout << "\nError: could not use '" << job.outdir << "' for the intermediate files\n" << std::endl;
+        metrics_save(job, 1);
+        unlock_master(lockfd, 1);
+        return 1;
     }
-    return filecontents;
+
+    rc = build_in_outdir(job, skipped);
+
+    if(rc == 0 && !publish_output(job))
+        rc = 1;
+
+    if(job.publishdir != "" && aux_root != "")
+        evict_aux_dirs(); // while still holding on to this one
+    release_aux_dir(auxfd);
+    metrics_save(job, rc);
+    unlock_master(lockfd, rc);
+    return rc;
 }
+
 #endif
 
-int execute_command(std::string compile, std::string bib, std::string openpdf, std::string outopts, std::string output_viewer)
+int execute_command(const build_job &job)
 {
+    std::string compile = job.compcall, bib = job.bibcall, openpdf = job.openpdfcall;
+
     // prints the commands about to be executed, for checking mistakes/bugs etc
     std::cout << std::endl;
     std::cout << "LaTeX compilation command:" << std::endl;
     std::cout << compile << "\n" << std::endl;
     std::cout << "Bibliography manager command:" << std::endl;
     std::cout << bib << "\n" << std::endl;
+    for(auto argv:{&job.index_argv, &job.glossary_argv, &job.nomencl_argv})
+    {
+        if(!argv->empty())
+            std::cout << "Auxiliary command:\n" << join_arguments(*argv) << "\n" << std::endl;
+    }
     std::cout << "Open with command:" << std::endl;
     std::cout << openpdf << "\n" << std::endl;
 
@@ -286,13 +299,23 @@ int execute_command(std::string compile, std::string bib, std::string openpdf, s
 
     std::cout << "==============================================================================\n" << std::endl;
 
-    // convert std::string commands to char*
-    char *compstr = &compile[0u];
-    char *bibstr = &bib[0u];
-    char *pdfstr = &openpdf[0u];
+    #ifdef SYSTEM_IS_WINDOWS
+    if(incremental_build && compile != "" && cache_is_fresh(job))
+    {
+        // nothing the last build read has changed, so the output already on disk is up to date
+        std::cout << "Nothing has changed since the last build, skipping compilation\n" << std::endl;
+        compile = "";
+        bib = "";
+    }
+    #endif
 
     #ifdef SYSTEM_IS_WINDOWS
         //{
+        // convert std::string commands to char*
+        char *compstr = &compile[0u];
+        char *bibstr = &bib[0u];
+        char *pdfstr = &openpdf[0u];
+
         // Win32 witchcraft
         PROCESS_INFORMATION pi;
         STARTUPINFO si;
@@ -301,15 +324,22 @@ int execute_command(std::string compile, std::string bib, std::string openpdf, s
 
         int rc;
 
+        if(compile != "" && preflight_build && !preflight_sources(job))
+            return 1;
+
         if(compile != "")
         {
+            DWORD status = 1;
+
             // run the latex engine command string
             rc = CreateProcess(NULL, compstr, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
             WaitForSingleObject( pi.hProcess, INFINITE ); // wait for process to complete
+            if(rc)
+                GetExitCodeProcess( pi.hProcess, &status ); // a failed run mustn't be followed by the bib engine and another
             CloseHandle( pi.hProcess ); // remove handle to process
             CloseHandle( pi.hThread ); // remove thread
 
-            if(!rc) // if return command is not 0, an error has occurred
+            if(!rc || status != 0) // if return command is not 0, an error has occurred
             {
                 std::cout << "\nError: document compilation failed\n" << std::endl;
                 return 255; // IT'S ONE FIRE!!!! RUN FOR IT!!!!! ABORT! ABORT!
@@ -335,6 +365,8 @@ int execute_command(std::string compile, std::string bib, std::string openpdf, s
             CloseHandle( pi.hProcess ); // clean
             CloseHandle( pi.hThread );
         }
+        if(compile != "" && incremental_build)
+            cache_store(job); // remember what this build read so the next one can be skipped
         if(openpdf != "") // if the output file should be opened in something
         {
             // execute program
@@ -352,141 +384,81 @@ int execute_command(std::string compile, std::string bib, std::string openpdf, s
 
     #ifdef SYSTEM_IS_LINUX
 
-        if(compile != "")
-        {
-            system(compstr);
-        }
-
-        if(bib != "")
-        {
-            system(bibstr);
-            system(compstr);
-        }
+        if(compile != "" && compile_document(job) != 0)
+            return 1;
 
         if(openpdf != "")
-        {
-            std::string grepstring = modify_for_grep(openpdf, outopts.size());
-
-            FILE * grepres = popen(grepstring.c_str(), "r");
-
-            std::string grep_output = get_stdout(grepres);
-
-            pclose(grepres);
-
-            if(grep_output == "")
-            {
-                system(pdfstr);
-            }
-            else if(refresh_viewer)
-            {
-                std::string pid_command = "pidof " + output_viewer;
-                FILE * pidof = popen(pid_command.c_str(), "r");
-
-                std::string pids_out = get_stdout(pidof);
-
-                pclose(pidof);
-
-                std::vector<std::string> pidlist = explode(pids_out, ' ');
-
-                for(auto pid:pidlist)
-                {
-                    std::string kill_command = "kill -1 " + pid;
-                    system(kill_command.c_str());
-                }
-            }
-        }
+            open_viewer(job);
 
     #endif
 
     return 0;
 }
 
-std::string remove_carriage_return(std::string s)
+std::string option_value(std::string options, std::string key)
 {
-    s.erase(std::remove(s.begin(), s.end(), '\r'), s.end());
-    return s;
+    // finds the value given to an option in an options string, e.g. for key "-output-directory=" in
+    // '-shell-escape --output-directory="/home/me/thesis"' this returns /home/me/thesis
+    size_t pos = options.find(key);
+
+    if(pos == std::string::npos)
+        return "";
+
+    std::vector<std::string> parts = explode(options.substr(pos + key.size()), ' ');
+
+    if(parts.empty())
+        return "";
+
+    std::string value = parts.front();
+    value.erase(std::remove(value.begin(), value.end(), '"'), value.end());
+    return value;
 }
 
-int parse_file(std::string dir, std::string file)
+static int resolve_chain(std::string dir, std::string file, build_job &job, std::vector<std::string> &chain)
 {
     // dir must have a '\' at the end, this is added automatically in main()
-    std::ifstream ifile;
-    std::vector<std::string> flineargs;
-    std::string line, engine, bibengine, options, master, compcall, bibcall, openpdfcall, biboptions, outext, openwith, outopts;
+    std::string line, engine, bibengine, options, master, compcall, bibcall, openpdfcall, biboptions, outext, openwith, outopts, maxpasses;
+    std::string index, glossary, nomencl, focus, variants;
     bool otherargs = false; // set to true if anything other than master is specified, for detecting redundant options when master is specified
 
     std::string texpath = dir + file; // full path to file to be compiled
 
-    ifile.open(texpath); // open file to be compiled (maybe)
-
-    std::cout << "Reading first line of '" << texpath << "'" << std::endl;
-    getline(ifile, line); // read the first line
-
-    ifile.close(); // close file, all the data we need has been read
+    profile_scope resolving("resolve " + file, "resolve"); // a master= shows up nested inside the file pointing to it
+    resolving.arg("path", texpath);
+    double parse_start = profile_now();
 
-    eliminate_whitespace(line); // remove whitespace, excluding that between = and ;
+    specifiers spec;
+    chain.push_back(normalise_path(texpath)); // what led here, so a master= pointing back into it can be caught
 
-    line.erase(0,1); // discard first character. if first line is useful, this will be a %
-
-    line = remove_carriage_return(line); // remove carriage return from the line to make linux-safe
-
-    flineargs = explode(line, ';'); // split arguments up
-
-    for(std::string arg:flineargs) // for each specifier-value pair...
+    if(lookup_specifiers(texpath, spec))
+        std::cout << "First line of '" << texpath << "' unchanged since it was last read" << std::endl;
+    else
     {
-        if(arg.substr(0,7) == "master=") // redirect the program to a master file
-        {
-            master = arg.substr(7);
-            std::cout << "Found specifier for master file: '" << master << "'" << std::endl;
-        }
-        else if(arg.substr(0,7) == "engine=") // LaTeX engine, e.g. xelatex, pdflatex
-        {
-            otherargs = true;
-            engine = arg.substr(7);
-            std::cout << "Found specifier for LaTeX engine: '" << engine << "'" << std::endl;
-        }
-        else if(arg.substr(0,4) == "bib=") // bibliography engine, e.g. biber, bibtex
-        {
-            otherargs = true;
-            bibengine = arg.substr(4);
-            std::cout << "Found specifier for bibliography engine: '" << bibengine << "'" << std::endl;
-        }
-        else if(arg.substr(0,8) == "options=") // options to pass to LaTeX engine
-        {
-            otherargs = true;
-            options = arg.substr(8);
-            std::cout << "Found specifier for LaTeX compiler options: '" << options << "'" << std::endl;
-        }
-        else if(arg.substr(0,11) == "biboptions=") // options to pass to bibliography engine
-        {
-            otherargs = true;
-            biboptions = arg.substr(11);
-            std::cout << "Found specifier for bibliography engine options: '" << biboptions << "'" << std::endl;
-        }
-        else if(arg.substr(0,7) == "outext=") // extension of output file
-        {
-            otherargs = true;
-            outext = arg.substr(7);
-            std::cout << "Found specifier for output file extension: '" << outext << "'" << std::endl;
-        }
-        else if(arg.substr(0,9) == "openwith=") // file to open output file with (can be 'none')
-        {
-            otherargs = true;
-            openwith = arg.substr(9);
-            std::cout << "Found specifier for program to open output with: '" << openwith << "'" << std::endl;
-        }
-        else if(arg.substr(0,11) == "outoptions=") // options to pass to the above program (can be 'none')
-        {
-            otherargs = true;
-            outopts = arg.substr(11);
-            std::cout << "Found specifier for output viewer options: '" << outopts << "'" << std::endl;
-        }
-        else // that's all this program accepts
-        {
-            std::cout << "Unknown specifier key '" << arg << "', ignoring..." << std::endl;
-        }
+        std::cout << "Reading first line of '" << texpath << "'" << std::endl;
+        read_first_line(texpath, line); // all the data we need, a missing file just has no specifiers
+
+        parse_specifiers(line, spec); // engine=, bib=, master= and so on
+        index_specifiers(texpath, spec);
     }
 
+    master = spec.master;
+    engine = spec.engine;
+    bibengine = spec.bibengine;
+    options = spec.options;
+    biboptions = spec.biboptions;
+    outext = spec.outext;
+    openwith = spec.openwith;
+    outopts = spec.outopts;
+    maxpasses = spec.maxpasses;
+    index = spec.index;
+    glossary = spec.glossary;
+    nomencl = spec.nomencl;
+    focus = spec.focus;
+    variants = spec.variants;
+    otherargs = spec.otherargs;
+
+    profile_record("parse first line", "resolve", parse_start, profile_now(), {});
+
     // adding ability to set default master
     // this seems like a very bad idea and I can't think of any way it could be useful, but here you go anyway
     if(master == "" && master != default_master)
@@ -513,17 +485,26 @@ int parse_file(std::string dir, std::string file)
 
         size_t slashpos = newpath.find_last_of('/'); // the name of the master file is all characters after the last slash in the path
 
-        if(file_exists(newpath))
+        if(std::find(chain.begin(), chain.end(), normalise_path(newpath)) != chain.end())
+        {
+            // following it would go round forever, so treat it like a missing master
+            std::cout << "\nWarning: master= files form a cycle: ";
+            for(auto &path:chain)
+                std::cout << "'" << path << "' -> ";
+            std::cout << "'" << normalise_path(newpath) << "', attempting to compile current file...\n" << std::endl;
+        }
+        else if(file_exists(newpath))
         {
             std::cout << "Found master file, parsing master file now...\n" << std::endl;
             // if the master file does exist (yay), recursively call this function again and then discard this instance
-            parse_file(newpath.substr(0,slashpos+1), newpath.substr(slashpos + 1));
-            return 0;
+            return resolve_chain(newpath.substr(0,slashpos+1), newpath.substr(slashpos + 1), job, chain);
+        }
+        else
+        {
+            // master file does not exist, carry on trying to compile this file
+            // other specifiers come back into play here
+            std::cout << "\nWarning: master file '" << newpath << "' not found, attempting to compile current file...\n" << std::endl;
         }
-        // master file does not exist, carry on trying to compile this file
-        // other specifiers come back into play here
-        std::cout << "\nWarning: master file '" << newpath << "' not found, attempting to compile current file...\n" << std::endl;
-
     }
     std::cout << std::endl;
 
@@ -564,6 +545,41 @@ int parse_file(std::string dir, std::string file)
         std::cout << "No specifier for output viewer options found, defaulting to '" << default_outoptions << "'" << std::endl;
         outopts = default_outoptions;
     }
+    if(maxpasses == "" && maxpasses != default_maxpasses)
+    {
+        std::cout << "No specifier for maximum engine passes found, defaulting to '" << default_maxpasses << "'" << std::endl;
+        maxpasses = default_maxpasses;
+    }
+    if(index == "" && index != default_index)
+    {
+        std::cout << "No specifier for index processor found, defaulting to '" << default_index << "'" << std::endl;
+        index = default_index;
+    }
+    if(glossary == "" && glossary != default_glossary)
+    {
+        std::cout << "No specifier for glossary processor found, defaulting to '" << default_glossary << "'" << std::endl;
+        glossary = default_glossary;
+    }
+    if(nomencl == "" && nomencl != default_nomencl)
+    {
+        std::cout << "No specifier for nomenclature processor found, defaulting to '" << default_nomencl << "'" << std::endl;
+        nomencl = default_nomencl;
+    }
+    if(focus == "" && focus != default_focus)
+    {
+        std::cout << "No specifier for focused builds found, defaulting to '" << default_focus << "'" << std::endl;
+        focus = default_focus;
+    }
+    if(variants == "" && variants != default_variants)
+    {
+        std::cout << "No specifier for build variants found, defaulting to '" << default_variants << "'" << std::endl;
+        variants = default_variants;
+    }
+    if(atoi(maxpasses.c_str()) < 1)
+    {
+        std::cout << "Warning: maximum engine passes must be at least 1, using 1" << std::endl;
+        maxpasses = "1";
+    }
     //}
 
 	// if the value is equal to dont_use_specvalue, overwrite the default
@@ -575,6 +591,14 @@ int parse_file(std::string dir, std::string file)
         outext = "";
     if(outopts == dont_use_specvalue)
         outopts = "";
+    if(index == dont_use_specvalue)
+        index = "";
+    if(glossary == dont_use_specvalue)
+        glossary = "";
+    if(nomencl == dont_use_specvalue)
+        nomencl = "";
+    if(variants == dont_use_specvalue)
+        variants = "";
 
 	// change all forward slashes to backslashes
     sanitise_path(openwith);
@@ -582,10 +606,6 @@ int parse_file(std::string dir, std::string file)
     sanitise_path(biboptions);
     sanitise_path(outopts);
 
-    #ifdef SYSTEM_IS_LINUX
-    outopts += " &";
-    #endif
-
     std::cout << std::endl;
 
     if(dir != "")
@@ -593,6 +613,29 @@ int parse_file(std::string dir, std::string file)
 
     std::cout << "Compiling optional arguments..." << std::endl;
 
+    // finds position of the file extension - the last dot in the name
+    // used because bibliography engines like to be given the name part only - e.g. for main.tex the bib engine just wants 'main'
+    size_t shortdotpos = file.find_last_of('.'); // biber likes to be given '--output-directory' and JUST the filename
+
+    std::string outdir = dir;
+
+    if(output_root != "")
+    {
+        // one directory per document, the hash keeps two main.tex files in different places apart
+        outdir = join_path(output_root, file.substr(0,shortdotpos) + "-" + hex64(hash_string(texpath)).substr(0,8));
+    }
+
+    std::string publishdir;
+
+    #ifdef SYSTEM_IS_LINUX
+    if(aux_root != "" && options.find("-output-directory=") == std::string::npos)
+    {
+        // the small files go somewhere quick and are kept for next time, only the output goes where it otherwise would
+        publishdir = outdir;
+        outdir = join_path(aux_root, hex64(hash_string(texpath)));
+    }
+    #endif
+
     #ifdef COMPILER_IS_MIKTEX
     // --aux-directory is only used by MiKTeX
     if(options.find("-aux-directory=") == std::string::npos)
@@ -606,14 +649,20 @@ int parse_file(std::string dir, std::string file)
     if(options.find("-output-directory=") == std::string::npos)
     {
         // tell LaTeX engine where the working directory is, if the user has not manually specified this
-        options += " --output-directory=\"" + dir + "\"";
+        options += " --output-directory=\"" + outdir + "\"";
+    }
+
+    if((incremental_build || watch_mode || store_root != "" || shared_store != "") && options.find("-recorder") == std::string::npos)
+    {
+        // the .fls file written by -recorder is how the build cache, watch mode and the store know what the document depends on
+        options += " -recorder";
     }
 
     if(biboptions.find("-output-directory=") == std::string::npos && bibengine == "biber")
     {
         // tell bibliography engine where the working directory is, if the user has not manually specified this
         // biber is special and uses --output-directory instead of --include-directory
-        biboptions += " --output-directory=\"" + dir + "\"";
+        biboptions += " --output-directory=\"" + outdir + "\"";
     }
     else if(biboptions.find("-include-directory=") == std::string::npos)
     {
@@ -621,19 +670,39 @@ int parse_file(std::string dir, std::string file)
         //biboptions += " --include-directory=\"" + dir + "\"";
     }
 
-    // finds position of the file extension - the last dot in the path
-    // used because bibliography engines like to be given the name part only - e.g. for main.tex the bib engine just wants 'main'
-    size_t dotpos = texpath.find_last_of('.');
-    size_t shortdotpos = file.find_last_of('.'); // biber likes to be given '--output-directory' and JUST the filename
+    outdir = option_value(options, "-output-directory="); // the user may have picked their own
+    std::string viewdir = publishdir != "" ? publishdir : outdir; // where the output ends up
 
     // assemble the LaTeX engine command from the various bits
     if(engine != "" && engine != dont_use_specvalue) // only do this is the value is not empty and not dont_use_specvalue
+    {
         compcall = engine + " --halt-on-error " + options + " \"" + texpath + "\"";
 
+        // the same again as separate arguments, for running without a shell
+        job.comp_argv = {engine, "--halt-on-error"};
+        for(auto &arg:split_arguments(options))
+            job.comp_argv.push_back(arg);
+        job.comp_argv.push_back(texpath);
+    }
+
+    std::string viewname = file.substr(0,shortdotpos);
+
+    #ifdef SYSTEM_IS_LINUX
+    job.variants = split_variants(variants);
+    if(!job.variants.empty())
+        viewname += "-" + job.variants[0].first; // nothing is named after the master itself, so the first variant
+    #endif
+
     // assemble the call to the program to open the output file with
     // the output file will be the file's name part plus whatever extension the user is using
     if(openwith != "" && openwith != dont_use_specvalue) // if user has specified to not open the output file in anything, this call will be empty
-        openpdfcall = "\"" + openwith + "\" \"" + texpath.substr(0,dotpos) + outext + "\" " + outopts;
+    {
+        openpdfcall = "\"" + openwith + "\" \"" + join_path(viewdir, viewname) + outext + "\" " + outopts;
+
+        job.open_argv = {openwith, join_path(viewdir, viewname) + outext};
+        for(auto &arg:split_arguments(outopts))
+            job.open_argv.push_back(arg);
+    }
 
     if(bibengine != "" && bibengine != dont_use_specvalue) // if a bibliography engine has been specified, construct the call
     {
@@ -642,17 +711,127 @@ int parse_file(std::string dir, std::string file)
         std::cout << "Compiling bibliography information..." << std::endl;
 
         bibcall = bibengine + " " + biboptions + " \"" + bibcall + "\""; // construct call
+
+        job.bib_argv = {bibengine};
+        for(auto &arg:split_arguments(biboptions))
+            job.bib_argv.push_back(arg);
+        job.bib_argv.push_back(file.substr(0,shortdotpos));
     }
 
-    execute_command(compcall, bibcall, openpdfcall, outopts, openwith); // execute!
+    // the other auxiliary programs all work on files next to the .aux, named after the job
+    std::string jobname = file.substr(0,shortdotpos);
+    if(index != "")
+        job.index_argv = {index, jobname + ".idx"};
+    if(glossary != "")
+        job.glossary_argv = {glossary, jobname};
+    if(nomencl != "")
+        job.nomencl_argv = {nomencl, jobname + ".nlo", "-s", "nomencl.ist", "-o", jobname + ".nls"};
+
+    job.dir = dir;
+    job.file = file;
+    job.texpath = texpath;
+    job.jobname = file.substr(0,shortdotpos);
+    job.outdir = outdir;
+    job.publishdir = publishdir;
+    job.engine = engine;
+    job.options = options;
+    job.bibengine = bibengine;
+    job.biboptions = biboptions;
+    job.outext = outext;
+    job.openwith = openwith;
+    job.outopts = outopts;
+    job.index = index;
+    job.glossary = glossary;
+    job.nomencl = nomencl;
+    job.focus = focus == "yes";
+    job.compcall = compcall;
+    job.bibcall = bibcall;
+    job.openpdfcall = openpdfcall;
+    job.max_passes = atoi(maxpasses.c_str());
 
     return 0;
 }
 
+int resolve_job(std::string dir, std::string file, build_job &job)
+{
+    std::vector<std::string> chain;
+    return resolve_chain(dir, file, job, chain);
+}
+
+static void focus_job(build_job &job, const std::string &path)
+{
+    // the master is built through a wrapper that \includeonly's the file the build was started from. the engine
+    // still reads every other \include's .aux, so numbering and cross-references come out as in a full build
+    if(job.comp_argv.empty() || normalise_path(path) == normalise_path(job.texpath))
+        return;
+
+    if(!job.variants.empty())
+    {
+        std::cout << "Focused builds don't work with variants=, building all of '" << job.texpath << "'\n" << std::endl;
+        return;
+    }
+
+    std::string unit = include_unit(job.texpath, path);
+    if(unit == "")
+    {
+        std::cout << "'" << path << "' isn't \\include'd by '" << job.texpath << "', building all of it\n" << std::endl;
+        return;
+    }
+
+    std::string wrapper = join_path(job.outdir, job.jobname + ".focus.tex");
+
+    make_directories(job.outdir);
+    std::ofstream ofile(wrapper);
+    ofile << "\\includeonly{" << unit << "}\\input{" << job.file << "}\n"; // the engine runs in the master's directory
+    ofile.close();
+
+    if(!ofile)
+    {
+        std::cout << "Warning: could not write '" << wrapper << "', building all of '" << job.texpath << "'\n" << std::endl;
+        return;
+    }
+
+    std::cout << "Building only '" << unit << "' of '" << job.texpath << "'\n" << std::endl;
+
+    // the same job name keeps the .aux, .log and output where a full build puts them
+    job.comp_argv.back() = "-jobname=" + job.jobname;
+    job.comp_argv.push_back(wrapper);
+    job.compcall = job.compcall.substr(0, job.compcall.size() - job.texpath.size() - 2) + "-jobname=" + job.jobname + " \"" + wrapper + "\"";
+}
+
+int parse_file(std::string dir, std::string file)
+{
+    build_job job;
+    int rc;
+
+    {
+        profile_scope whole("texbuild " + file, "texbuild");
+
+        resolve_job(dir, file, job); // follow master= and work out the commands
+        save_master_index();
+
+        if(focus_build || job.focus)
+            focus_job(job, dir + file);
+
+        rc = execute_command(job); // execute!
+    }
+
+    if(profile_build)
+    {
+        std::string path = profile_file != "" ? profile_file : join_path(job.outdir, job.jobname + ".trace.json");
+
+        std::cout << "\n" << profile_summary() << std::endl;
+        if(write_profile(path))
+            std::cout << "Trace written to '" << path << "'" << std::endl;
+        else
+            std::cout << "Warning: could not write the trace to '" << path << "'" << std::endl;
+    }
+    return rc;
+}
+
 int main(int argc, char *argv[])
 {
     const char *homedir;
-    std::cout << "This is TeXbuild v" << version << "\n" << std::endl;
 
     #ifdef SYSTEM_IS_LINUX
         // retrieves the home directory on linux
@@ -667,7 +846,206 @@ int main(int argc, char *argv[])
         config_path = std::string(homedir) + "/AppData/Roaming/TeXbuild/";
     #endif
 
-    if (argc != 3)
+    std::vector<std::string> args; // everything that isn't a --flag
+    bool batch_mode = false, scan_mode = false, affected_mode = false, daemon_mode = false, client_mode = false, stats_mode = false;
+    int batch_jobs = 0; // 0 means one per core
+    int priority = 0; // for builds requested from the daemon
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if(arg == "--incremental") // only recompile if something has changed since the last build
+            incremental_build = true;
+        else if(arg == "--force") // ignore the incremental build cache
+            force_build = true;
+        else if(arg == "--no-format") // load the preamble every time rather than from a precompiled format
+            precompile_preamble = false;
+        else if(arg == "--focus") // build only the \include'd file given, not the whole of its master
+            focus_build = true;
+        else if(arg == "--no-draft") // let every pass write the output, not just the last
+            draft_passes = false;
+        else if(arg == "--no-figures") // leave converting figures to the engine, through shell escape
+            preconvert_figures = false;
+        else if(arg == "--preflight") // check the sources for mistakes the engine would stop at before starting it
+            preflight_build = true;
+        else if(arg == "--watch") // rebuild every time a source file changes
+            watch_mode = true;
+        else if(arg.substr(0, 11) == "--debounce=") // milliseconds to wait for more saves before rebuilding
+            watch_debounce_ms = atoi(arg.substr(11).c_str());
+        else if(arg == "--batch") // build every file, directory or glob given
+            batch_mode = true;
+        else if(arg == "--scan") // update the dependency graph for the masters of the files given
+            scan_mode = true;
+        else if(arg == "--affected") // list the masters that depend on the files given
+            affected_mode = true;
+        else if(arg == "--stats") // how past builds went, for every document or the masters of the files given
+            stats_mode = true;
+        else if(arg == "--profile") // time each phase and write a Chrome trace next to the output
+            profile_build = true;
+        else if(arg.substr(0, 10) == "--profile=") // the same, but write the trace here
+        {
+            profile_build = true;
+            profile_file = arg.substr(10);
+        }
+        else if(arg == "--daemon") // stay running and build whatever --client asks for
+            daemon_mode = true;
+        else if(arg == "--client") // ask the daemon to do the build, and show its progress
+            client_mode = true;
+        else if(arg.substr(0, 11) == "--priority=") // builds with a higher priority jump the daemon's queue
+            priority = atoi(arg.substr(11).c_str());
+        else if(arg.substr(0, 10) == "--timeout=") // kill the engine if it runs for longer than this many seconds
+            process_timeout = atoi(arg.substr(10).c_str());
+        else if(arg.substr(0, 7) == "--jobs=") // how many documents to build at once in batch mode
+            batch_jobs = atoi(arg.substr(7).c_str());
+        else if(arg == "--store") // reuse the output of identical builds, from ~/.texbuild/store
+            store_root = config_path + "store";
+        else if(arg.substr(0, 8) == "--store=") // the same, somewhere else
+        {
+            store_root = arg.substr(8);
+            sanitise_path(store_root);
+        }
+        else if(arg.substr(0, 15) == "--shared-store=") // another store to look in and save to, e.g. on a network mount
+        {
+            shared_store = arg.substr(15);
+            sanitise_path(shared_store);
+        }
+        else if(arg.substr(0, 14) == "--store-limit=") // megabytes of builds to keep in the local store
+            store_limit_mb = atol(arg.substr(14).c_str());
+        else if(arg == "--auxdir") // keep intermediate files in RAM between runs, only copy the output back
+            aux_root = "/dev/shm/texbuild";
+        else if(arg.substr(0, 9) == "--auxdir=") // the same, somewhere else
+        {
+            aux_root = arg.substr(9);
+            sanitise_path(aux_root);
+        }
+        else if(arg.substr(0, 15) == "--auxdir-limit=") // megabytes of intermediate files to keep before evicting
+            aux_root_limit_mb = atol(arg.substr(15).c_str());
+        else if(arg.substr(0, 9) == "--outdir=") // give every document its own output directory under here
+        {
+            output_root = arg.substr(9);
+            sanitise_path(output_root);
+        }
+        else if(arg.substr(0, 2) == "--")
+        {
+            std::cout << "Error: unknown option '" << arg << "'" << std::endl;
+            std::cout << "See documentation for details" << std::endl;
+            std::cout << "Exiting TeXbuild..." << std::endl;
+            return 1;
+        }
+        else
+            args.push_back(arg);
+    }
+
+    #ifdef SYSTEM_IS_LINUX
+    if(affected_mode)
+        return affected_command(args); // no banner, the output is meant for other programs
+
+    if(client_mode)
+    {
+        // the daemon prints its own banner along with everything else
+        int rc = run_client(args, priority);
+
+        if(rc >= 0)
+            return rc;
+        if(args.size() != 2)
+        {
+            std::cout << "Error: no texbuild daemon is running" << std::endl;
+            return 1;
+        }
+        std::cout << "No texbuild daemon is running, building here instead\n" << std::endl;
+    }
+    #endif
+
+    std::cout << "This is TeXbuild v" << version << "\n" << std::endl;
+
+    if(output_root != "")
+    {
+        // the engine runs from the document's directory, so a relative path here would end up in the wrong place
+        make_directories(output_root);
+        output_root = absolute_path(output_root);
+    }
+
+    if(aux_root != "")
+    {
+        make_directories(aux_root);
+        aux_root = absolute_path(aux_root);
+    }
+
+    for(auto root:{&store_root, &shared_store})
+    {
+        if(*root != "")
+        {
+            make_directories(*root);
+            *root = absolute_path(*root);
+        }
+    }
+
+    if(scan_mode)
+    {
+        #ifdef SYSTEM_IS_LINUX
+        #ifdef USE_CONFIG_FILE_DEFAULTS
+        read_config_file(); // get defaults from config.txt
+        #endif
+
+        return scan_command(args);
+        #else
+        std::cout << "Error: scan mode is only available on Linux" << std::endl;
+        return 1;
+        #endif
+    }
+
+    if(stats_mode)
+    {
+        #ifdef SYSTEM_IS_LINUX
+        #ifdef USE_CONFIG_FILE_DEFAULTS
+        read_config_file(); // get defaults from config.txt
+        #endif
+
+        return stats_command(args);
+        #else
+        std::cout << "Error: build statistics are only available on Linux" << std::endl;
+        return 1;
+        #endif
+    }
+
+    if(daemon_mode)
+    {
+        #ifdef SYSTEM_IS_LINUX
+        #ifdef USE_CONFIG_FILE_DEFAULTS
+        read_config_file(); // once, restart the daemon to pick up changes
+        #endif
+
+        incremental_build = true; // the point is to answer every save, most of which change nothing that matters
+        return run_daemon(batch_jobs);
+        #else
+        std::cout << "Error: daemon mode is only available on Linux" << std::endl;
+        return 1;
+        #endif
+    }
+
+    if(batch_mode)
+    {
+        #ifdef SYSTEM_IS_LINUX
+        if(args.empty())
+        {
+            std::cout << "Error: batch mode needs at least one file, directory or glob" << std::endl;
+            std::cout << "Exiting TeXbuild..." << std::endl;
+            return 1;
+        }
+
+        #ifdef USE_CONFIG_FILE_DEFAULTS
+        read_config_file(); // get defaults from config.txt
+        #endif
+
+        return run_batch(args, batch_jobs);
+        #else
+        std::cout << "Error: batch mode is only available on Linux" << std::endl;
+        return 1;
+        #endif
+    }
+
+    if (args.size() != 2)
     {
         std::cout << "Error: TeXbuild takes two arguments only" << std::endl;
         std::cout << "See documentation for details" << std::endl;
@@ -675,9 +1053,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    std::string namepart = argv[2];
+    std::string namepart = args[1];
     // path must be absolute not relative
-    std::string directory = argv[1];
+    std::string directory = args[0];
 
     sanitise_path(directory); // change forward slashes to backslashes
 
@@ -701,7 +1079,22 @@ int main(int argc, char *argv[])
 
     #endif
 
-    parse_file(directory, namepart);
+    if(watch_mode)
+    {
+        #ifdef SYSTEM_IS_LINUX
+        build_job job;
 
-    return 0;
+        resolve_job(directory, namepart, job);
+        save_master_index();
+
+        if(focus_build || job.focus)
+            focus_job(job, directory + namepart); // every rebuild goes through the same wrapper
+        return run_watch(job);
+        #else
+        std::cout << "Error: watch mode is only available on Linux" << std::endl;
+        return 1;
+        #endif
+    }
+
+    return parse_file(directory, namepart);
 }
@@ -0,0 +1,359 @@
+#include "masterindex.h"
+#include "fileutil.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// on disk: the header, then a power of two number of slots, an open addressing hash table on the path,
+// then every string the slots point into. written in one go and renamed into place, never modified
+static const char index_magic[8] = {'T', 'B', 'M', 'I', 'D', 'X', '4', '\n'};
+
+struct index_header
+{
+    char magic[8];
+    uint32_t slots;
+    uint32_t entries;
+    uint64_t strings_size;
+};
+
+struct index_string
+{
+    uint32_t offset, length; // into the strings after the slots
+};
+
+struct index_record
+{
+    uint64_t path_hash; // 0 for an empty slot
+    int64_t mtime_sec, mtime_nsec, size;
+    index_string path;
+    index_string fields[specifier_key_count]; // in specifier_key order
+    uint32_t otherargs;
+};
+
+// what a file looked like when it was read
+struct file_stamp
+{
+    int64_t mtime_sec, mtime_nsec, size;
+
+    bool operator==(const file_stamp &other) const
+    {
+        return mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec && size == other.size;
+    }
+};
+
+struct indexed_file
+{
+    file_stamp stamp;
+    specifiers spec;
+};
+
+struct index_map
+{
+    void *data;
+    size_t size;
+    const index_header *header;
+    const index_record *slots;
+    const char *strings;
+};
+
+static index_map mapped = {NULL, 0, NULL, NULL, NULL}; // the index as it was when first looked at
+static bool mapped_tried = false;
+static std::unordered_map<std::string, indexed_file> pending; // read since then, not yet saved
+
+static std::string index_path()
+{
+    return config_path + "masters";
+}
+
+static uint64_t path_hash(const std::string &path)
+{
+    uint64_t h = hash_string(path);
+    return h ? h : 1; // 0 marks an empty slot
+}
+
+static bool stamp_of(const std::string &path, file_stamp &stamp)
+{
+    struct stat st;
+
+    if(stat(path.c_str(), &st) != 0)
+        return false;
+
+    stamp.mtime_sec = st.st_mtim.tv_sec;
+    stamp.mtime_nsec = st.st_mtim.tv_nsec;
+    stamp.size = st.st_size;
+    return true;
+}
+
+static void unmap_index(index_map &map)
+{
+    if(map.data)
+        munmap(map.data, map.size);
+    map = index_map{NULL, 0, NULL, NULL, NULL};
+}
+
+static bool map_index(index_map &map)
+{
+    int fd = open(index_path().c_str(), O_RDONLY);
+    struct stat st;
+
+    map = index_map{NULL, 0, NULL, NULL, NULL};
+
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_header))
+    {
+        close(fd);
+        return false;
+    }
+
+    map.size = st.st_size;
+    map.data = mmap(NULL, map.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file alive, even once it has been replaced
+
+    if(map.data == MAP_FAILED)
+    {
+        map.data = NULL;
+        return false;
+    }
+
+    map.header = (const index_header *)map.data;
+    map.slots = (const index_record *)(map.header + 1);
+    map.strings = (const char *)(map.slots + map.header->slots);
+
+    // anything that doesn't add up is treated as no index at all, it gets rewritten on the next save
+    uint64_t expected = sizeof(index_header) + (uint64_t)map.header->slots * sizeof(index_record) + map.header->strings_size;
+    if(memcmp(map.header->magic, index_magic, sizeof index_magic) != 0 || map.header->slots == 0
+       || (map.header->slots & (map.header->slots - 1)) != 0 || expected != map.size)
+    {
+        unmap_index(map);
+        return false;
+    }
+
+    madvise(map.data, map.size, MADV_RANDOM); // only the slots probed and their strings get touched
+    return true;
+}
+
+static std::string_view record_string(const index_map &map, index_string s)
+{
+    if((uint64_t)s.offset + s.length > map.header->strings_size)
+        return std::string_view();
+    return std::string_view(map.strings + s.offset, s.length);
+}
+
+static const index_record *find_record(const index_map &map, const std::string &path)
+{
+    if(!map.data)
+        return NULL;
+
+    uint64_t h = path_hash(path);
+    uint32_t mask = map.header->slots - 1;
+
+    for(uint32_t i = h & mask, probes = 0; probes < map.header->slots; i = (i + 1) & mask, probes++)
+    {
+        const index_record &record = map.slots[i];
+
+        if(record.path_hash == 0)
+            return NULL;
+        if(record.path_hash == h && record_string(map, record.path) == path)
+            return &record;
+    }
+    return NULL;
+}
+
+bool lookup_specifiers(const std::string &path, specifiers &spec)
+{
+    file_stamp stamp;
+
+    if(!stamp_of(path, stamp))
+        return false;
+
+    auto found = pending.find(path);
+    if(found != pending.end())
+    {
+        if(!(found->second.stamp == stamp))
+            return false;
+        spec = found->second.spec;
+        return true;
+    }
+
+    if(!mapped_tried)
+    {
+        map_index(mapped);
+        mapped_tried = true;
+    }
+
+    const index_record *record = find_record(mapped, path);
+    if(!record || !(file_stamp{record->mtime_sec, record->mtime_nsec, record->size} == stamp))
+        return false;
+
+    spec = specifiers();
+    for(int key = 0; key < specifier_key_count; key++)
+        (spec.*(specifier_for((specifier_key)key).field)).assign(record_string(mapped, record->fields[key]));
+    spec.otherargs = record->otherargs != 0;
+    return true;
+}
+
+void index_specifiers(const std::string &path, const specifiers &spec)
+{
+    indexed_file entry;
+
+    if(!stamp_of(path, entry.stamp))
+        return;
+
+    entry.spec = spec;
+    pending[path] = entry;
+}
+
+static index_string add_string(std::string &strings, std::string_view s)
+{
+    index_string added = {(uint32_t)strings.size(), (uint32_t)s.size()};
+    strings.append(s.data(), s.size());
+    return added;
+}
+
+static void insert_record(std::vector<index_record> &slots, const index_record &record)
+{
+    size_t mask = slots.size() - 1;
+
+    for(size_t i = record.path_hash & mask;; i = (i + 1) & mask)
+    {
+        if(slots[i].path_hash == 0)
+        {
+            slots[i] = record;
+            return;
+        }
+    }
+}
+
+bool save_master_index()
+{
+    if(pending.empty())
+        return true;
+
+    if(!make_directories(config_path))
+        return false;
+
+    // several batch builds or a daemon may be saving at once, take turns and merge with whatever is there now
+    int lockfd = open((config_path + "masters.lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if(lockfd >= 0)
+        flock(lockfd, LOCK_EX);
+
+    index_map current;
+    map_index(current);
+
+    // records carried over are checked against their files, so deleted and edited ones don't pile up forever
+    size_t entries = pending.size(), slot_count = 16;
+    std::vector<bool> keep(current.data ? current.header->slots : 0);
+    for(uint32_t i = 0; i < keep.size(); i++)
+    {
+        const index_record &record = current.slots[i];
+        std::string path;
+        file_stamp stamp;
+
+        if(record.path_hash == 0)
+            continue;
+        path = record_string(current, record.path);
+        if(pending.count(path) || !stamp_of(path, stamp) || !(file_stamp{record.mtime_sec, record.mtime_nsec, record.size} == stamp))
+            continue;
+        keep[i] = true;
+        entries++;
+    }
+    while(slot_count < entries * 2) // at most half full keeps the probes short
+        slot_count *= 2;
+
+    std::vector<index_record> slots(slot_count);
+    std::string strings;
+
+    memset(slots.data(), 0, slots.size() * sizeof(index_record));
+
+    for(uint32_t i = 0; i < keep.size(); i++)
+    {
+        if(!keep[i])
+            continue;
+
+        index_record record = current.slots[i];
+
+        record.path = add_string(strings, record_string(current, record.path));
+        for(int key = 0; key < specifier_key_count; key++)
+            record.fields[key] = add_string(strings, record_string(current, current.slots[i].fields[key]));
+        insert_record(slots, record);
+    }
+
+    for(auto &entry:pending)
+    {
+        index_record record;
+
+        memset(&record, 0, sizeof record);
+        record.path_hash = path_hash(entry.first);
+        record.mtime_sec = entry.second.stamp.mtime_sec;
+        record.mtime_nsec = entry.second.stamp.mtime_nsec;
+        record.size = entry.second.stamp.size;
+        record.path = add_string(strings, entry.first);
+        for(int key = 0; key < specifier_key_count; key++)
+            record.fields[key] = add_string(strings, entry.second.spec.*(specifier_for((specifier_key)key).field));
+        record.otherargs = entry.second.spec.otherargs;
+        insert_record(slots, record);
+    }
+
+    unmap_index(current);
+
+    index_header header;
+    memcpy(header.magic, index_magic, sizeof index_magic);
+    header.slots = slot_count;
+    header.entries = entries;
+    header.strings_size = strings.size();
+
+    std::string path = index_path();
+    std::ofstream ofile(path + ".tmp", std::ios::binary);
+
+    ofile.write((const char *)&header, sizeof header);
+    ofile.write((const char *)slots.data(), slots.size() * sizeof(index_record));
+    ofile.write(strings.data(), strings.size());
+    ofile.close();
+
+    bool saved = ofile && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+
+    if(lockfd >= 0)
+        close(lockfd); // releases the lock too
+
+    if(saved)
+    {
+        // later lookups in this process go to the new index
+        pending.clear();
+        unmap_index(mapped);
+        map_index(mapped);
+        mapped_tried = true;
+    }
+    else
+        std::cout << "Warning: could not save the master index to '" << path << "'" << std::endl;
+    return saved;
+}
+
+#else
+
+bool lookup_specifiers(const std::string &path, specifiers &spec)
+{
+    return false;
+}
+
+void index_specifiers(const std::string &path, const specifiers &spec)
+{
+}
+
+bool save_master_index()
+{
+    return true;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef MASTERINDEX_H
+#define MASTERINDEX_H
+
+#include "texbuild.h"
+#include "specifiers.h"
+
+#include <string>
+
+// config_path/masters, the first line specifiers of every file resolve_job has read, keyed by path, mtime and size,
+// so following a master= chain through unchanged files costs a stat each rather than an open and a read.
+// the file is a hash table that gets mapped in as it is, looking a file up doesn't read the rest of the index
+
+// false if path isn't indexed, has changed since, or can't be stat'd
+bool lookup_specifiers(const std::string &path, specifiers &spec);
+
+// remembers what was read from path the slow way, kept in memory until save_master_index
+void index_specifiers(const std::string &path, const specifiers &spec);
+
+// merges anything new into the index on disk, safe to call from several processes
+bool save_master_index();
+
+#endif
@@ -0,0 +1,162 @@
+#include "masterlock.h"
+#include "depgraph.h"
+#include "process.h"
+#include "fileutil.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <sstream>
+#include <cerrno>
+#include <csignal>
+#include <climits>
+
+#include <fcntl.h>
+#include <sys/file.h>
+
+static uint64_t held_fingerprint; // of the sources the build holding the lock started from
+
+// what the lock file says
+struct lock_state
+{
+    std::string state; // building or done, anything else means there's nothing to go on
+    pid_t pid;
+    uint64_t fingerprint;
+    int rc;
+};
+
+static uint64_t sources_fingerprint(const build_job &job)
+{
+    // the command and every source the scanner can find, which is what a build started now would read
+    uint64_t h = hash_string(join_arguments(job.comp_argv)), filehash;
+    std::vector<std::string> paths(1, job.texpath);
+
+    for(auto &dep:scan_dependencies(job.texpath))
+        paths.push_back(dep.path);
+
+    for(auto &path:paths)
+    {
+        h = hash_string(path + "\n", h);
+        if(hash_file(path, filehash))
+            h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+    }
+    return h;
+}
+
+static lock_state read_state(int fd)
+{
+    // building <pid> <fingerprint> while a build runs, done <fingerprint> <exit status> once it has finished
+    lock_state result = {"", 0, 0, 0};
+    char buffer[128];
+    ssize_t n = pread(fd, buffer, sizeof buffer - 1, 0);
+
+    if(n <= 0)
+        return result;
+
+    std::istringstream line(std::string(buffer, n));
+    std::string fingerprint;
+
+    line >> result.state;
+    if(result.state == "building")
+        line >> result.pid >> fingerprint;
+    else if(result.state == "done")
+        line >> fingerprint >> result.rc;
+
+    if(!line || !parse_hex64(fingerprint, result.fingerprint))
+        result.state = "";
+    return result;
+}
+
+static void write_state(int fd, const std::string &text)
+{
+    if(ftruncate(fd, 0) != 0 || pwrite(fd, text.data(), text.size(), 0) != (ssize_t)text.size())
+        std::cout << "Warning: could not update the build lock" << std::endl;
+}
+
+static bool is_texbuild(pid_t pid)
+{
+    // the pid in the lock file may be left over from a build that died, and since taken by something else entirely
+    char mine[PATH_MAX], theirs[PATH_MAX];
+    ssize_t a = readlink("/proc/self/exe", mine, sizeof mine), b = readlink(("/proc/" + std::to_string(pid) + "/exe").c_str(), theirs, sizeof theirs);
+
+    return a > 0 && a == b && std::string(mine, a) == std::string(theirs, b);
+}
+
+static void on_superseded(int)
+{
+    stop_requested = 1; // the engine is stopped, and nothing more is started
+}
+
+int lock_master(const build_job &job, bool &joined, int &rc)
+{
+    joined = false;
+
+    if(!make_directories(config_path + "locks"))
+        return -1;
+
+    std::string path = config_path + "locks/" + job_key(job);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if(fd < 0)
+        return -1;
+
+    uint64_t fingerprint = sources_fingerprint(job);
+    bool waited = false;
+
+    if(flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        lock_state running = read_state(fd);
+
+        if(running.state == "building" && running.fingerprint == fingerprint)
+            std::cout << "A build of '" << job.texpath << "' from the same sources is already running, waiting for it..." << std::endl;
+        else
+        {
+            std::cout << "A build of '" << job.texpath << "' from older sources is running, stopping it..." << std::endl;
+            if(running.state == "building" && running.pid > 0 && is_texbuild(running.pid))
+                kill(running.pid, SIGUSR1);
+        }
+
+        while(flock(fd, LOCK_EX) != 0 && errno == EINTR) {}
+        waited = true;
+    }
+
+    if(waited)
+    {
+        // the sources may have moved on while waiting, and if the build that just finished was of exactly what
+        // is there now, what it made is what this one would
+        lock_state last = read_state(fd);
+
+        fingerprint = sources_fingerprint(job);
+        if(last.state == "done" && last.fingerprint == fingerprint)
+        {
+            joined = true;
+            rc = last.rc;
+            close(fd);
+            return -1;
+        }
+    }
+
+    // before the pid goes in the file, a SIGUSR1 it prompts mustn't find the default action still in place
+    struct sigaction action = {};
+    action.sa_handler = on_superseded;
+    sigaction(SIGUSR1, &action, NULL);
+
+    held_fingerprint = fingerprint;
+    write_state(fd, "building " + std::to_string(getpid()) + " " + hex64(fingerprint) + "\n");
+    return fd;
+}
+
+void unlock_master(int fd, int rc)
+{
+    if(fd < 0)
+        return;
+
+    // a build that was stopped made nothing anyone waiting should take as theirs
+    if(stop_requested)
+        write_state(fd, "stopped\n");
+    else
+        write_state(fd, "done " + hex64(held_fingerprint) + " " + std::to_string(rc) + "\n");
+    close(fd); // releases the lock too
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef MASTERLOCK_H
+#define MASTERLOCK_H
+
+#include "texbuild.h"
+
+#ifdef SYSTEM_IS_LINUX
+// one build per master (and variant) at a time, across every texbuild process, locked on config_path/locks/<job_key>.
+// the build holding the lock writes its pid and a fingerprint of the sources it started from there. a request for
+// the same sources waits for it and takes its result, one for newer sources stops it and builds once it has gone
+
+// returns once it is this process's turn, with a descriptor for unlock_master (-1 if locking failed, build anyway)
+// joined is set if a build of the same sources finished while waiting, its exit status is in rc and there is
+// nothing left to do
+int lock_master(const build_job &job, bool &joined, int &rc);
+
+void unlock_master(int fd, int rc); // records how the build went, for anyone waiting to join it
+#endif
+
+#endif
@@ -0,0 +1,399 @@
+#include "metrics.h"
+#include "batch.h"
+#include "cache.h"
+#include "variants.h"
+#include "fileutil.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <cstdio>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+static const char *record_version = "1";         // first field of every line, so the format can change
+static const off_t max_metrics_size = 4 << 20;   // bytes, the older half goes once the file grows past this
+static const size_t trend_builds = 10;           // how many earlier compiles a new one is compared with
+static const double regression_ratio = 1.2;      // slower than the median of those by this much is worth a mention
+static const double regression_min_ms = 500;     // unless it's only a fraction of a second either way
+
+// time spent in one kind of program, over the whole build
+struct step_time
+{
+    std::string name;
+    double wall, cpu; // milliseconds
+};
+
+// one line of the metrics file
+struct build_record
+{
+    time_t time;
+    std::string key, inputs, engine, master;
+    int rc, passes;
+    double wall, cpu;
+    std::vector<step_time> steps;
+};
+
+static std::vector<step_time> build_steps;
+static int engine_runs;
+static double build_wall, build_cpu;
+
+static double wall_now()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double cpu_now(int who)
+{
+    // user and system time of this process, or of every child it has waited for
+    struct rusage usage;
+    getrusage(who, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+metrics_timer::metrics_timer() : wall(wall_now()), cpu(cpu_now(RUSAGE_CHILDREN)) {}
+
+void metrics_timer::record(const std::string &name)
+{
+    metrics_step(name, wall_now() - wall, cpu_now(RUSAGE_CHILDREN) - cpu);
+}
+
+void metrics_step(const std::string &name, double wall_ms, double cpu_ms)
+{
+    if(name == "engine")
+        engine_runs++;
+
+    for(auto &step:build_steps)
+    {
+        if(step.name == name)
+        {
+            step.wall += wall_ms;
+            step.cpu += cpu_ms;
+            return;
+        }
+    }
+    build_steps.push_back({name, wall_ms, cpu_ms});
+}
+
+void metrics_begin()
+{
+    build_steps.clear();
+    engine_runs = 0;
+    build_wall = wall_now();
+    build_cpu = cpu_now(RUSAGE_SELF) + cpu_now(RUSAGE_CHILDREN);
+}
+
+static uint64_t input_hash(const build_job &job)
+{
+    // everything the build read, two records with the same hash are builds of identical sources
+    std::vector<std::string> inputs = read_recorded_inputs(job);
+    uint64_t h = hash_string(job.compcall), filehash;
+
+    inputs.push_back(job.texpath);
+    std::sort(inputs.begin(), inputs.end());
+    inputs.erase(std::unique(inputs.begin(), inputs.end()), inputs.end());
+
+    for(auto &path:inputs)
+    {
+        h = hash_string(path + "\n", h);
+        if(hash_file(path, filehash))
+            h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+    }
+    return h;
+}
+
+static void trim_metrics(const std::string &path)
+{
+    // with the lock held, keeps the newer half
+    std::string contents, tmp = path + ".tmp";
+
+    if(!read_whole_file(path, contents))
+        return;
+
+    size_t cut = contents.find('\n', contents.size() / 2);
+    if(cut == std::string::npos)
+        return;
+
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if(!out)
+        return;
+
+    bool ok = fwrite(contents.data() + cut + 1, 1, contents.size() - cut - 1, out) == contents.size() - cut - 1;
+    ok = fclose(out) == 0 && ok;
+
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        remove(tmp.c_str());
+}
+
+static void append_record(const std::string &record)
+{
+    std::string path = config_path + "metrics";
+
+    // a trim swaps in a new file, so one that was trimmed while we waited for the lock has to be opened again
+    for(int attempt = 0; attempt < 3; attempt++)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+
+        if(fd < 0)
+            return;
+        if(flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0 || st.st_nlink == 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        if(write(fd, record.data(), record.size()) == (ssize_t)record.size() && st.st_size + (off_t)record.size() > max_metrics_size)
+            trim_metrics(path);
+        close(fd); // releases the lock too
+        return;
+    }
+}
+
+void metrics_save(const build_job &job, int rc)
+{
+    if(!make_directories(config_path))
+        return;
+
+    std::string engine = job.comp_argv.empty() ? "-" : job.comp_argv[0].substr(job.comp_argv[0].find_last_of('/') + 1);
+    std::ostringstream line;
+
+    line << record_version << " " << time(NULL) << " " << job_key(job) << " " << rc << " " << engine_runs << " "
+         << hex64(input_hash(job)) << " " << (long)(wall_now() - build_wall) << " "
+         << (long)(cpu_now(RUSAGE_SELF) + cpu_now(RUSAGE_CHILDREN) - build_cpu) << " " << engine;
+    for(auto &step:build_steps)
+        line << " " << step.name << "=" << (long)step.wall << "/" << (long)step.cpu;
+    line << " | " << job.texpath << "\n";
+
+    append_record(line.str());
+}
+
+static bool parse_record(const std::string &line, build_record &record)
+{
+    size_t bar = line.find(" | ");
+    if(bar == std::string::npos)
+        return false;
+
+    std::istringstream fields(line.substr(0, bar));
+    std::string version, step;
+    long long when;
+
+    if(!(fields >> version >> when >> record.key >> record.rc >> record.passes >> record.inputs >> record.wall >> record.cpu >> record.engine)
+       || version != record_version)
+        return false;
+
+    record.time = when;
+    record.master = line.substr(bar + 3);
+    record.steps.clear();
+
+    // <name>=<wall>/<cpu>
+    while(fields >> step)
+    {
+        size_t equals = step.find('='), slash = step.find('/');
+
+        if(equals == std::string::npos || slash == std::string::npos || slash < equals)
+            return false;
+        record.steps.push_back({step.substr(0, equals), atof(step.substr(equals + 1).c_str()), atof(step.substr(slash + 1).c_str())});
+    }
+    return true;
+}
+
+static std::vector<build_record> read_records()
+{
+    std::vector<build_record> records;
+    std::string contents;
+
+    read_whole_file(config_path + "metrics", contents);
+
+    std::istringstream lines(contents);
+    std::string line;
+    build_record record;
+
+    while(getline(lines, line))
+    {
+        if(parse_record(line, record))
+            records.push_back(record);
+    }
+    return records;
+}
+
+std::map<std::string, double> last_durations()
+{
+    std::map<std::string, double> durations;
+
+    for(auto &record:read_records())
+    {
+        if(record.passes > 0 && record.rc == 0)
+            durations[record.key] = record.wall;
+    }
+    return durations;
+}
+
+double expected_duration(const build_job &job, const std::map<std::string, double> &durations)
+{
+    // variants are built side by side, so it's the slowest of them
+    std::vector<std::string> keys;
+    double longest = -1;
+
+    if(job.variants.empty())
+        keys.push_back(job_key(job));
+    for(size_t i = 0; i < job.variants.size(); i++)
+        keys.push_back(job_key(variant_job(job, i)));
+
+    for(auto &key:keys)
+    {
+        auto found = durations.find(key);
+        if(found != durations.end())
+            longest = std::max(longest, found->second);
+    }
+    return longest;
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values.size() % 2 ? values[values.size() / 2] : (values[values.size() / 2 - 1] + values[values.size() / 2]) / 2;
+}
+
+static std::string seconds(double ms)
+{
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << ms / 1000 << "s";
+    return text.str();
+}
+
+static std::string change(double now, double before)
+{
+    std::ostringstream text;
+    text << std::showpos << (long)((now - before) * 100 / std::max(before, 1.0)) << "%";
+    return text.str();
+}
+
+static void print_document(const std::vector<build_record> &records)
+{
+    // compiles are what the trend is about, a build that found nothing to do says nothing about how long one takes
+    std::vector<const build_record *> compiles;
+    int failed = 0;
+
+    for(auto &record:records)
+    {
+        if(record.rc != 0)
+            failed++;
+        else if(record.passes > 0)
+            compiles.push_back(&record);
+    }
+
+    const build_record &last = records.back();
+    std::string variant = last.key.size() > 17 ? last.key.substr(17) : "";
+    char when[32];
+    strftime(when, sizeof when, "%Y-%m-%d %H:%M", localtime(&last.time));
+
+    std::cout << last.master << (variant != "" ? " [" + variant + "]" : "") << "\n"
+              << "  " << records.size() << (records.size() == 1 ? " build" : " builds") << ", " << compiles.size() << " compiled, "
+              << failed << " failed, last " << when << " with exit status " << last.rc << std::endl;
+
+    if(compiles.empty())
+        return;
+
+    const build_record &latest = *compiles.back();
+    size_t first = compiles.size() > trend_builds + 1 ? compiles.size() - trend_builds - 1 : 0;
+    std::vector<const build_record *> earlier(compiles.begin() + first, compiles.end() - 1);
+
+    std::cout << "  last compile: " << latest.passes << (latest.passes == 1 ? " pass" : " passes") << " of " << latest.engine
+              << ", " << seconds(latest.wall) << " wall, " << seconds(latest.cpu) << " CPU" << std::endl;
+
+    for(auto &step:latest.steps)
+    {
+        std::vector<double> before;
+        for(auto record:earlier)
+        {
+            for(auto &other:record->steps)
+            {
+                if(other.name == step.name)
+                    before.push_back(other.wall);
+            }
+        }
+
+        std::cout << "    " << std::left << std::setw(10) << step.name << std::right << std::setw(8) << seconds(step.wall)
+                  << " wall " << std::setw(8) << seconds(step.cpu) << " CPU";
+        if(!before.empty())
+            std::cout << "  (median " << seconds(median(before)) << ", " << change(step.wall, median(before)) << ")";
+        std::cout << std::endl;
+    }
+
+    std::cout << "  trend:";
+    for(size_t i = first; i < compiles.size(); i++)
+        std::cout << " " << seconds(compiles[i]->wall);
+    std::cout << std::endl;
+
+    if(earlier.size() < 3)
+        return;
+
+    std::vector<double> before;
+    for(auto record:earlier)
+        before.push_back(record->wall);
+
+    double typical = median(before);
+    if(latest.wall > typical * regression_ratio && latest.wall - typical > regression_min_ms)
+    {
+        // the same inputs taking longer points at the machine or the installation rather than the document
+        bool same_inputs = earlier.back()->inputs == latest.inputs;
+
+        std::cout << "  REGRESSION: " << change(latest.wall, typical) << " on the median of the " << earlier.size()
+                  << " compiles before it" << (same_inputs ? ", with the same inputs as the one before" : "") << std::endl;
+    }
+}
+
+int stats_command(const std::vector<std::string> &paths)
+{
+    std::vector<build_record> records = read_records();
+    std::set<std::string> wanted; // master hashes, every document if empty
+
+    if(!paths.empty())
+    {
+        for(auto &job:resolve_masters(expand_batch_paths(paths)))
+            wanted.insert(hex64(hash_string(job.texpath)));
+        std::cout << std::endl;
+
+        if(wanted.empty())
+            return 1;
+    }
+
+    // by document, the most recently built first
+    std::map<std::string, std::vector<build_record> > documents;
+    std::vector<std::pair<time_t, std::string> > order;
+
+    for(auto &record:records)
+    {
+        if(wanted.empty() || wanted.count(record.key.substr(0, 16)))
+            documents[record.key].push_back(record);
+    }
+
+    if(documents.empty())
+    {
+        std::cout << "No builds recorded " << (paths.empty() ? "yet" : "for these documents") << std::endl;
+        return paths.empty() ? 0 : 1;
+    }
+
+    for(auto &document:documents)
+        order.push_back(std::make_pair(document.second.back().time, document.first));
+    std::sort(order.rbegin(), order.rend());
+
+    for(auto &entry:order)
+    {
+        print_document(documents[entry.second]);
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+#endif
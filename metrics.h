@@ -0,0 +1,38 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+#ifdef SYSTEM_IS_LINUX
+// every build appends a line to config_path/metrics saying what was built, how it went and where the time went:
+//   1 <time> <job key> <exit status> <passes> <input hash> <wall ms> <cpu ms> <engine> <step>=<wall ms>/<cpu ms>... | <master>
+// with the time spent in each kind of program (engine, bib, format and so on) added up over the build.
+// texbuild --stats reads it back, and batch mode starts the builds that took longest last time first
+
+// times one program (or several run together) from construction until record
+class metrics_timer
+{
+public:
+    metrics_timer();
+    void record(const std::string &name); // adds the wall and CPU time since construction to the build in progress
+
+private:
+    double wall, cpu;
+};
+
+void metrics_step(const std::string &name, double wall_ms, double cpu_ms); // for children reaped elsewhere
+void metrics_begin(); // a build starts, anything recorded before is forgotten
+void metrics_save(const build_job &job, int rc);
+
+// job key -> wall ms of the most recent build that ran the engine and succeeded
+std::map<std::string, double> last_durations();
+double expected_duration(const build_job &job, const std::map<std::string, double> &durations); // < 0 if never built
+
+int stats_command(const std::vector<std::string> &paths); // texbuild --stats, every document or the masters of these files
+#endif
+
+#endif
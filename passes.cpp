@@ -0,0 +1,221 @@
+#include "passes.h"
+#include "cache.h"
+#include "fileutil.h"
+#include "process.h"
+#include "diagnostics.h"
+#include "profile.h"
+#include "metrics.h"
+#include "steps.h"
+
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <cstdio>
+
+// files the engine reads back in on the next pass, if any of these change another pass is needed
+static const char *aux_extensions[] = {".aux", ".toc", ".bcf", ".out", ".lof", ".lot"};
+
+// how each engine is told to skip writing its output while still writing the auxiliary files, those not
+// listed (latex itself, whose .dvi costs next to nothing) run every pass in full
+static const struct { const char *engine, *option; } draft_options[] = {
+    {"pdflatex", "-draftmode"}, {"pdftex", "-draftmode"}, {"lualatex", "-draftmode"}, {"luatex", "-draftmode"},
+    {"xelatex", "-no-pdf"}, {"xetex", "-no-pdf"}
+};
+
+static std::string draft_option(const build_job &job)
+{
+    std::string engine = job.engine.substr(job.engine.find_last_of('/') + 1);
+
+    for(auto &draft:draft_options)
+    {
+        if(engine == draft.engine)
+            return draft.option;
+    }
+    return "";
+}
+
+static uint64_t aux_state(const build_job &job)
+{
+    // one hash covering all the auxiliary files, a missing file hashes differently to an empty one
+    uint64_t h = hash_seed;
+
+    for(auto ext:aux_extensions)
+    {
+        uint64_t filehash;
+
+        if(hash_file(join_path(job.outdir, job.jobname + ext), filehash))
+            h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+        else
+            h = hash_string("missing", h);
+    }
+    return h;
+}
+
+static uint64_t aux_citations(const std::string &auxpath, uint64_t h, int depth, bool *cited = NULL)
+{
+    // the lines bibtex cares about, following \@input{chapter.aux} from \include'd files
+    std::ifstream ifile(auxpath);
+    std::string line;
+
+    while(getline(ifile, line))
+    {
+        if(line.substr(0, 10) == "\\citation{" || line.substr(0, 9) == "\\bibdata{" || line.substr(0, 10) == "\\bibstyle{")
+        {
+            h = hash_string(line + "\n", h);
+            if(cited && line[1] == 'c')
+                *cited = true;
+        }
+        else if(line.substr(0, 8) == "\\@input{" && depth < 8)
+        {
+            std::string child = line.substr(8, line.find('}') - 8);
+            h = aux_citations(join_path(parent_directory(auxpath), child), h, depth + 1, cited);
+        }
+    }
+    return h;
+}
+
+bool citations_to_process(const build_job &job)
+{
+    // bibtex fails when nothing is cited and biber when there is no .bcf, a document without a bibliography has neither
+    bool cited = false;
+
+    if(job.bibengine == "biber")
+        return file_exists(join_path(job.outdir, job.jobname + ".bcf"));
+
+    aux_citations(join_path(job.outdir, job.jobname + ".aux"), 0, 0, &cited);
+    return cited;
+}
+
+uint64_t citation_fingerprint(const build_job &job)
+{
+    // the command itself, what is cited (biber reads everything it needs from the .bcf) and the databases it comes from
+    uint64_t h = hash_string(job.bibcall), filehash;
+
+    if(job.bibengine == "biber" && hash_file(join_path(job.outdir, job.jobname + ".bcf"), filehash))
+        h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+    else
+        h = aux_citations(join_path(job.outdir, job.jobname + ".aux"), h, 0);
+
+    for(auto &bib:find_bib_files(job))
+    {
+        h = hash_string(bib + "\n", h);
+        if(hash_file(bib, filehash))
+            h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+    }
+    return h;
+}
+
+bool log_requests_rerun(const build_job &job)
+{
+    output_parser parser;
+    return parse_log_file(join_path(job.outdir, job.jobname + ".log"), parser) && parser.wants_rerun();
+}
+
+int run_passes(const build_job &job)
+{
+    // state as the previous build left it, so an up to date document converges after a single pass
+    uint64_t before = aux_state(job);
+    int rc = 0;
+
+    // the bib engine, makeindex and so on, each only run again when what they would make could differ
+    std::vector<aux_step> steps = auxiliary_steps(job);
+
+    // \input{chapter} and friends are looked up relative to the working directory, not the master file
+    process_options engine_options;
+    engine_options.directory = job.dir;
+    engine_options.timeout = process_timeout;
+
+    if(job.figuredir != "")
+    {
+        const char *value = getenv("TEXINPUTS");
+        engine_options.environment.push_back("TEXINPUTS=" + job.figuredir + ":" + (value ? value : "")); // : for the default path
+    }
+
+    // a pass only skips the output when another is certain to follow it: on a first build, or one where a step
+    // has yet to run, the first pass can't be the last. after that any pass might be, so it writes the output,
+    // and a draft pass that turns out to have converged is followed by one that does
+    std::string draft = draft_passes ? draft_option(job) : "";
+    bool draft_next = draft != "" && (!file_exists(join_path(job.outdir, job.jobname + ".aux")) || auxiliary_steps_pending(job, steps));
+
+    for(int pass = 1; ; pass++)
+    {
+        bool draft_pass = draft_next && pass < job.max_passes;
+        std::vector<std::string> argv = job.comp_argv;
+
+        draft_next = false;
+        if(draft_pass)
+            argv.insert(argv.begin() + 1, draft);
+
+        std::cout << "\nRunning engine, pass " << pass << (draft_pass ? " (draft, no output)" : "") << "...\n" << std::endl;
+
+        // the output still goes to the terminal, but the first error stops the engine there and then rather
+        // than leaving it to carry on through the rest of the document
+        output_parser live;
+        engine_options.output_filter = [&live](const char *data, size_t len)
+        {
+            std::cout.write(data, len);
+            std::cout.flush();
+            live.feed(data, len);
+            return !live.failed();
+        };
+
+        {
+            profile_scope timing("engine pass " + std::to_string(pass) + (draft_pass ? " (draft)" : ""), profile_engine);
+            metrics_timer timer;
+            rc = run_process(argv, engine_options);
+            timer.record("engine");
+        }
+        live.finish();
+
+        if(rc != 0 || live.failed())
+        {
+            if(rc == process_aborted && stop_requested)
+            {
+                std::cout << "\n\nStopped, a build from newer sources is taking over\n" << std::endl;
+                return rc;
+            }
+            if(rc == process_aborted)
+                std::cout << "\n\nStopped the engine at the first error" << std::endl;
+            print_diagnostics(live.diagnostics());
+            std::cout << "\nError: document compilation failed\n" << std::endl;
+            return rc != 0 ? rc : 1;
+        }
+
+        // the .log has everything, including what the engine didn't print to the terminal
+        output_parser log;
+        parse_log_file(join_path(job.outdir, job.jobname + ".log"), log);
+
+        uint64_t after = aux_state(job);
+        bool rerun = after != before || log.wants_rerun();
+
+        int steprc = run_auxiliary_steps(job, steps, rerun);
+        if(stop_requested)
+        {
+            std::cout << "\nStopped, a build from newer sources is taking over\n" << std::endl;
+            return process_aborted;
+        }
+        if(steprc != 0)
+            return steprc;
+
+        before = after;
+
+        if(!rerun && draft_pass)
+        {
+            std::cout << "\nAuxiliary files are up to date, running once more for the output" << std::endl;
+            continue;
+        }
+        if(!rerun)
+        {
+            std::cout << "\nAuxiliary files are up to date after " << pass << (pass == 1 ? " pass" : " passes") << std::endl;
+            print_diagnostics(log.diagnostics());
+            break;
+        }
+        if(pass >= job.max_passes)
+        {
+            std::cout << "\nWarning: auxiliary files still changing after " << pass << " passes, giving up" << std::endl;
+            print_diagnostics(log.diagnostics());
+            break;
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,17 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <cstdint>
+
+// runs the engine, and the bib engine when the citations have changed, until the auxiliary files stop changing
+// returns the exit status of the last engine run
+int run_passes(const build_job &job);
+
+uint64_t citation_fingerprint(const build_job &job); // changes whenever the bib engine would produce something different
+bool citations_to_process(const build_job &job); // false if the bib engine would only fail for want of anything to do
+bool log_requests_rerun(const build_job &job); // true if the .log asks for another run
+
+#endif
@@ -0,0 +1,525 @@
+#include "preflight.h"
+#include "depgraph.h"
+#include "fileutil.h"
+#include "profile.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <string_view>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+enum math_kind { math_dollar, math_display, math_paren, math_bracket };
+
+static const char *math_openers[] = {"$", "$$", "\\(", "\\["}; // indexed by math_kind
+
+// environments TeX reads the contents of as they are, only their \end means anything
+static const char *verbatim_environments[] = {"verbatim", "verbatim*", "Verbatim", "Verbatim*", "BVerbatim", "LVerbatim",
+                                              "lstlisting", "minted", "comment", "filecontents", "filecontents*"};
+
+enum command_kind { command_inline_verbatim, command_raw_argument, command_definition, command_begin, command_end };
+
+// the commands the scan does something about, anything else after a backslash is passed over
+static const struct { std::string_view name; command_kind kind; } special_commands[] = {
+    {"begin", command_begin},
+    {"end", command_end},
+    {"verb", command_inline_verbatim},      // \verb|...|, taken as it is up to the second |
+    {"lstinline", command_inline_verbatim},
+    {"mintinline", command_inline_verbatim},
+    {"url", command_raw_argument},          // the braced argument is taken as it is, % and all
+    {"nolinkurl", command_raw_argument},
+    {"path", command_raw_argument},
+    {"href", command_raw_argument},
+    {"def", command_definition},            // followed by a definition, the body of which doesn't run where it's written
+    {"gdef", command_definition},
+    {"edef", command_definition},
+    {"xdef", command_definition},
+    {"newcommand", command_definition},
+    {"renewcommand", command_definition},
+    {"providecommand", command_definition},
+    {"DeclareRobustCommand", command_definition},
+    {"newenvironment", command_definition},
+    {"renewenvironment", command_definition},
+    {"NewDocumentCommand", command_definition},
+    {"RenewDocumentCommand", command_definition},
+    {"ProvideDocumentCommand", command_definition},
+    {"DeclareDocumentCommand", command_definition},
+    {"NewDocumentEnvironment", command_definition},
+    {"RenewDocumentEnvironment", command_definition}
+};
+
+struct open_environment
+{
+    std::string name;
+    size_t line;
+    size_t depth; // braces open at its \begin
+};
+
+struct open_math
+{
+    math_kind kind;
+    size_t line;
+    size_t depth;        // braces open where it started, a $ inside \text{...} starts math of its own
+    size_t environments; // environments open where it started
+};
+
+// how far the scan of one file has got
+struct scan_state
+{
+    const char *p, *end;
+    size_t line;
+    std::string file;
+    bool standalone;
+    std::vector<diagnostic> *found;
+
+    std::vector<size_t> braces; // the line each open { is on
+    std::vector<open_environment> environments;
+    std::vector<open_math> math;
+    bool defining;              // in the arguments of \newcommand and the like
+    size_t def_depth;           // braces open at that command
+};
+
+#ifdef __SSE2__
+// set up once rather than on every call, which is every few dozen bytes in a document full of commands
+static const __m128i all_backslashes = _mm_set1_epi8('\\'), all_percents = _mm_set1_epi8('%'), all_opens = _mm_set1_epi8('{'),
+                     all_closes = _mm_set1_epi8('}'), all_dollars = _mm_set1_epi8('$'), all_newlines = _mm_set1_epi8('\n');
+#endif
+
+static const char *find_special(const char *p, const char *end, bool newlines, size_t &line)
+{
+    // almost all of a document is text, so look at 16 bytes at a time where possible, counting the lines passed over
+    #ifdef __SSE2__
+    while(end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, all_backslashes), _mm_cmpeq_epi8(chunk, all_percents)),
+                                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, all_opens), _mm_cmpeq_epi8(chunk, all_closes)),
+                                                    _mm_cmpeq_epi8(chunk, all_dollars)));
+        int lines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, all_newlines));
+        int mask = _mm_movemask_epi8(special) | (newlines ? lines : 0);
+
+        if(mask)
+        {
+            int at = __builtin_ctz(mask);
+            line += __builtin_popcount(lines & ((1 << at) - 1));
+            return p + at;
+        }
+        line += __builtin_popcount(lines);
+        p += 16;
+    }
+    #endif
+    for(; p < end; p++)
+    {
+        if(*p == '\\' || *p == '%' || *p == '{' || *p == '}' || *p == '$' || (newlines && *p == '\n'))
+            break;
+        if(*p == '\n')
+            line++;
+    }
+    return p;
+}
+
+static bool is_letter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static void report(scan_state &s, size_t line, const std::string &message)
+{
+    diagnostic d = {diag_error, s.file, line, message};
+    s.found->push_back(d);
+}
+
+static std::string on_line(size_t line)
+{
+    return " on line " + std::to_string(line);
+}
+
+static bool read_name(scan_state &s, std::string &name)
+{
+    // the {name} after \begin or \end, left for the main loop if it isn't one
+    const char *q = s.p;
+
+    while(q < s.end && (*q == ' ' || *q == '\t'))
+        q++;
+    if(q == s.end || *q != '{')
+        return false;
+
+    const char *close = std::find(q, s.end, '}');
+    if(close == s.end || std::find(q, close, '\n') != close || std::find(q + 1, close, '{') != close)
+        return false;
+
+    name.assign(q + 1, close);
+    s.p = close + 1;
+    return true;
+}
+
+static void skip_raw_group(scan_state &s, const std::string &command)
+{
+    // s.p is on the opening brace, only braces count until the matching one
+    size_t line = s.line, depth = 0;
+
+    for(; s.p < s.end; s.p++)
+    {
+        if(*s.p == '\n')
+            s.line++;
+        else if(*s.p == '{')
+            depth++;
+        else if(*s.p == '}' && --depth == 0)
+        {
+            s.p++;
+            return;
+        }
+    }
+    report(s, line, "the argument of \\" + command + " is never closed");
+}
+
+static void skip_inline_verbatim(scan_state &s, const std::string &command)
+{
+    // \verb|...|, \lstinline[options]{...} and \mintinline{language}|...|, s.p is just after the name
+    if((command == "mintinline" && s.p < s.end && *s.p == '{') || (command == "lstinline" && s.p < s.end && *s.p == '['))
+    {
+        const char *close = std::find(s.p, s.end, *s.p == '{' ? '}' : ']');
+        s.p = close == s.end ? s.end : close + 1;
+    }
+    if(command == "verb" && s.p < s.end && *s.p == '*')
+        s.p++;
+    if(s.p == s.end)
+        return;
+
+    if(*s.p == '{' && command != "verb")
+    {
+        skip_raw_group(s, command);
+        return;
+    }
+
+    const char *close = std::find(s.p + 1, s.end, *s.p), *eol = std::find(s.p + 1, s.end, '\n');
+    if(close >= eol)
+    {
+        report(s, s.line, "\\" + command + " isn't closed on the line it starts on");
+        s.p = eol;
+        return;
+    }
+    s.p = close + 1;
+}
+
+static void open_math_mode(scan_state &s, math_kind kind)
+{
+    open_math m = {kind, s.line, s.braces.size(), s.environments.size()};
+    s.math.push_back(m);
+}
+
+static void dollar(scan_state &s)
+{
+    bool twice = s.p + 1 < s.end && s.p[1] == '$';
+
+    if(s.defining)
+    {
+        s.p += twice ? 2 : 1;
+        return;
+    }
+
+    if(s.math.empty() || s.math.back().depth != s.braces.size())
+    {
+        open_math_mode(s, twice ? math_display : math_dollar);
+        s.p += twice ? 2 : 1;
+        return;
+    }
+
+    // only ever one $ at a time closes inline math, $a$$b$ is two formulas
+    open_math top = s.math.back();
+    s.math.pop_back();
+
+    if(top.kind == math_dollar)
+        s.p++;
+    else if(top.kind == math_display)
+    {
+        if(!twice)
+            report(s, s.line, "display math opened with $$" + on_line(top.line) + " is closed with a single $");
+        s.p += twice ? 2 : 1;
+    }
+    else
+    {
+        report(s, s.line, "$ inside math opened with " + std::string(math_openers[top.kind]) + on_line(top.line));
+        s.p++;
+    }
+}
+
+static void close_math_mode(scan_state &s, math_kind kind)
+{
+    const char *closer = kind == math_paren ? "\\)" : "\\]";
+
+    if(!s.math.empty() && s.math.back().kind == kind && s.math.back().depth == s.braces.size())
+        s.math.pop_back();
+    else if(s.math.empty())
+        report(s, s.line, std::string(closer) + " without a matching " + math_openers[kind]);
+    else
+    {
+        report(s, s.line, std::string(closer) + " doesn't match the " + math_openers[s.math.back().kind] + on_line(s.math.back().line));
+        s.math.clear();
+    }
+}
+
+static bool arguments_follow(const scan_state &s)
+{
+    // \newcommand{\a}[1]{...} goes on until something other than another argument comes along
+    const char *q = s.p;
+
+    while(q < s.end && (*q == ' ' || *q == '\t' || *q == '\r' || *q == '\n'))
+        q++;
+    return q < s.end && (*q == '{' || *q == '[');
+}
+
+static void close_brace(scan_state &s)
+{
+    s.p++;
+
+    if(s.braces.empty())
+    {
+        report(s, s.line, "} without a matching {");
+        return;
+    }
+    s.braces.pop_back();
+
+    // math doesn't outlive its group, but array's >{$}c<{$} leaves it open on purpose, so it goes quietly
+    while(!s.math.empty() && s.math.back().depth > s.braces.size())
+        s.math.pop_back();
+
+    if(s.defining && s.braces.size() <= s.def_depth && !arguments_follow(s))
+        s.defining = false;
+}
+
+static void begin_environment(scan_state &s)
+{
+    size_t line = s.line;
+    std::string name;
+
+    if(!read_name(s, name))
+        return;
+
+    if(std::find(std::begin(verbatim_environments), std::end(verbatim_environments), name) != std::end(verbatim_environments))
+    {
+        std::string closing = "\\end{" + name + "}";
+        const char *at = std::search(s.p, s.end, closing.begin(), closing.end());
+
+        s.line += std::count(s.p, at, '\n');
+        if(at == s.end)
+            report(s, line, "\\begin{" + name + "} is never ended");
+        s.p = at == s.end ? s.end : at + closing.size();
+        return;
+    }
+
+    open_environment env = {name, line, s.braces.size()};
+    s.environments.push_back(env);
+}
+
+static void end_environment(scan_state &s)
+{
+    std::string name;
+
+    if(!read_name(s, name))
+        return;
+
+    // the innermost one of that name, anything begun after it was left open
+    size_t i = s.environments.size();
+    while(i > 0 && s.environments[i - 1].name != name)
+        i--;
+
+    if(i == 0)
+    {
+        // an \input'd file may end one its parent began
+        if(!s.environments.empty())
+            report(s, s.line, "\\end{" + name + "} doesn't match \\begin{" + s.environments.back().name + "}" + on_line(s.environments.back().line));
+        else if(s.standalone)
+            report(s, s.line, "\\end{" + name + "} without a matching \\begin");
+        return;
+    }
+
+    if(i < s.environments.size())
+        report(s, s.line, "\\end{" + name + "} doesn't match \\begin{" + s.environments.back().name + "}" + on_line(s.environments.back().line));
+
+    open_environment env = s.environments[i - 1];
+    s.environments.resize(i - 1);
+
+    // neither math nor a group can carry on past it
+    while(!s.math.empty() && s.math.back().environments >= i)
+    {
+        report(s, s.math.back().line, "math opened with " + std::string(math_openers[s.math.back().kind]) + " isn't closed before \\end{" + name + "}" + on_line(s.line));
+        s.math.pop_back();
+    }
+    if(s.braces.size() > env.depth)
+    {
+        report(s, s.braces[env.depth], "{ isn't closed before \\end{" + name + "}" + on_line(s.line));
+        s.braces.resize(env.depth);
+    }
+    else if(s.braces.size() < env.depth)
+        report(s, s.line, "a } between \\begin{" + name + "}" + on_line(env.line) + " and its \\end closes a group opened before it");
+
+    if(s.standalone && name == "document")
+        s.p = s.end; // TeX reads nothing after it
+}
+
+static void control_sequence(scan_state &s)
+{
+    const char *name = ++s.p;
+
+    if(s.p == s.end)
+        return;
+
+    // \{, \%, \\ and so on, only a few of which mean anything here
+    if(!is_letter(*s.p))
+    {
+        char c = *s.p++;
+
+        if(c == '\n')
+            s.line++;
+        else if(!s.defining && (c == '(' || c == '['))
+            open_math_mode(s, c == '(' ? math_paren : math_bracket);
+        else if(!s.defining && (c == ')' || c == ']'))
+            close_math_mode(s, c == ')' ? math_paren : math_bracket);
+        return;
+    }
+
+    while(s.p < s.end && is_letter(*s.p))
+        s.p++;
+
+    std::string_view word(name, s.p - name);
+    auto found = std::find_if(std::begin(special_commands), std::end(special_commands), [&word](const auto &command) { return command.name == word; });
+
+    if(found == std::end(special_commands))
+        return;
+
+    switch(found->kind)
+    {
+    case command_inline_verbatim:
+        skip_inline_verbatim(s, std::string(word));
+        break;
+    case command_raw_argument:
+        while(s.p < s.end && (*s.p == ' ' || *s.p == '\t'))
+            s.p++;
+        if(s.p < s.end && *s.p == '{')
+            skip_raw_group(s, std::string(word));
+        break;
+    case command_definition:
+        if(!s.defining)
+        {
+            s.defining = true;
+            s.def_depth = s.braces.size();
+        }
+        break;
+    case command_begin:
+        if(!s.defining)
+            begin_environment(s);
+        break;
+    case command_end:
+        if(!s.defining)
+            end_environment(s);
+        break;
+    }
+}
+
+void preflight_scan(const char *data, size_t len, const std::string &file, bool standalone, std::vector<diagnostic> &found)
+{
+    scan_state s;
+
+    s.p = data;
+    s.end = data + len;
+    s.line = 1;
+    s.file = file;
+    s.standalone = standalone;
+    s.found = &found;
+    s.defining = false;
+    s.def_depth = 0;
+
+    // newlines only matter in math, where a blank line ends the paragraph and TeX stops
+    while((s.p = find_special(s.p, s.end, !s.math.empty(), s.line)) < s.end)
+    {
+        switch(*s.p)
+        {
+        case '%':
+            s.p = std::find(s.p, s.end, '\n');
+            break;
+        case '{':
+            s.braces.push_back(s.line);
+            s.p++;
+            break;
+        case '}':
+            close_brace(s);
+            break;
+        case '$':
+            dollar(s);
+            break;
+        case '\\':
+            control_sequence(s);
+            break;
+        case '\n':
+        {
+            const char *q = ++s.p;
+            s.line++;
+
+            while(q < s.end && (*q == ' ' || *q == '\t' || *q == '\r'))
+                q++;
+            if(q < s.end && *q == '\n')
+            {
+                report(s, s.math.front().line, "math opened with " + std::string(math_openers[s.math.front().kind]) + " isn't closed before the blank line" + on_line(s.line));
+                s.math.clear();
+            }
+            break;
+        }
+        }
+    }
+
+    for(auto &m:s.math)
+        report(s, m.line, "math opened with " + std::string(math_openers[m.kind]) + " is never closed");
+    for(auto line:s.braces)
+        report(s, line, "{ is never closed");
+    if(s.standalone)
+    {
+        for(auto &env:s.environments)
+            report(s, env.line, "\\begin{" + env.name + "} is never ended");
+    }
+}
+
+bool preflight_sources(const build_job &job)
+{
+    profile_scope scope("pre-flight check", "preflight");
+    double start = profile_now();
+
+    // everything the engine reads as TeX, a subfile being a document of its own
+    std::vector<std::pair<std::string, bool> > files(1, std::make_pair(job.texpath, true));
+    for(auto &dep:scan_dependencies(job.texpath))
+    {
+        if(dep.kind == ref_input || dep.kind == ref_include || dep.kind == ref_subfile)
+            files.push_back(std::make_pair(dep.path, dep.kind == ref_subfile));
+    }
+
+    std::vector<diagnostic> found;
+    std::string contents;
+    size_t bytes = 0;
+
+    for(auto &file:files)
+    {
+        if(!read_whole_file(file.first, contents))
+            continue; // the engine will say so
+        bytes += contents.size();
+        preflight_scan(contents.data(), contents.size(), file.first, file.second, found);
+    }
+
+    scope.arg("files", std::to_string(files.size()));
+    scope.arg("problems", std::to_string(found.size()));
+
+    if(found.empty())
+    {
+        std::cout << "Pre-flight check found nothing wrong in " << files.size() << (files.size() == 1 ? " file" : " files") << " ("
+                  << (bytes + 1023) / 1024 << " KB in " << std::fixed << std::setprecision(1) << (profile_now() - start) / 1000 << " ms)\n" << std::endl;
+        return true;
+    }
+
+    print_diagnostics(found);
+    std::cout << "\nError: the pre-flight check found mistakes the engine would stop at, not compiling\n" << std::endl;
+    return false;
+}
@@ -0,0 +1,23 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include "texbuild.h"
+#include "diagnostics.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// texbuild --preflight, a look over the sources for the mistakes most failed builds come down to, before the engine
+// spends seconds loading the preamble only to stop at them: braces that don't balance, \begin's and \end's that don't
+// pair up, and math that is never closed. it only sees what the source looks like, not what any macro does, so where
+// it can't be sure it says nothing: verbatim text, \verb, \url's and the bodies of definitions are left alone
+
+// one file, standalone if every environment has to end in it (the master, or a subfile) rather than possibly in
+// whoever \input's it
+void preflight_scan(const char *data, size_t len, const std::string &file, bool standalone, std::vector<diagnostic> &found);
+
+// the master and everything it \input's, \include's or \subfile's, false (with what was found printed) if the engine would stop
+bool preflight_sources(const build_job &job);
+
+#endif
@@ -0,0 +1,343 @@
+#include "process.h"
+#include "profile.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#ifdef SYSTEM_IS_LINUX
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/wait.h>
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+#endif
+
+std::vector<std::string> split_arguments(const std::string &s)
+{
+    // explode() already keeps quoted spaces together, the quotes themselves are only there for the shell
+    std::vector<std::string> args;
+
+    for(auto arg:explode(s, ' '))
+    {
+        arg.erase(std::remove(arg.begin(), arg.end(), '"'), arg.end());
+        args.push_back(arg);
+    }
+    return args;
+}
+
+std::string join_arguments(const std::vector<std::string> &argv)
+{
+    std::string s;
+
+    for(auto &arg:argv)
+    {
+        if(s != "")
+            s += " ";
+        if(arg == "" || arg.find_first_of(" \t'\"\\$&;|<>()*?") != std::string::npos)
+            s += "\"" + arg + "\"";
+        else
+            s += arg;
+    }
+    return s;
+}
+
+#ifdef SYSTEM_IS_LINUX
+
+volatile sig_atomic_t stop_requested = 0;
+
+static int open_pidfd(pid_t pid)
+{
+    // a file descriptor that becomes readable when the process exits, so waiting with a timeout needs no polling loop
+    #ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+    #else
+    (void)pid;
+    return -1;
+    #endif
+}
+
+static int exit_status(int status)
+{
+    if(WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if(WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return process_not_started;
+}
+
+static void stop_process(pid_t pid, int &status, struct rusage &usage)
+{
+    // politely at first, the engine may want to close its files, then not so politely
+    kill(pid, SIGTERM);
+    for(int i = 0; i < 200 && wait4(pid, &status, WNOHANG, &usage) != pid; i++)
+        usleep(10000);
+    if(kill(pid, 0) == 0)
+    {
+        kill(pid, SIGKILL);
+        wait4(pid, &status, 0, &usage);
+    }
+}
+
+static int finished(const std::vector<std::string> &argv, double start, int rc, const struct rusage &usage)
+{
+    // where --profile gets each program's CPU time and memory from, wait4() having filled in usage
+    if(profile_build)
+    {
+        std::vector<std::pair<std::string, std::string> > args = {
+            {"command", join_arguments(argv)},
+            {"exit status", std::to_string(rc)},
+            {"user ms", std::to_string(usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000)},
+            {"system ms", std::to_string(usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000)},
+            {"peak RSS kB", std::to_string(usage.ru_maxrss)}
+        };
+        profile_record(argv[0].substr(argv[0].find_last_of('/') + 1), profile_process, start, profile_now(), args);
+    }
+    return rc;
+}
+
+static bool take_output(const process_options &options, const char *data, size_t len)
+{
+    // false if the filter wants the program stopped
+    if(options.output_filter)
+        return options.output_filter(data, len);
+    options.capture->append(data, len);
+    return true;
+}
+
+static void exec_child(const std::vector<std::string> &argv, const process_options &options, int capturefd, int errorfd)
+{
+    // only ever returns by _exit()ing, reporting errno down errorfd if anything goes wrong before the exec
+    int err;
+    std::vector<char *> cargv;
+
+    for(auto &arg:argv)
+        cargv.push_back(const_cast<char *>(arg.c_str()));
+    cargv.push_back(NULL);
+
+    if(options.directory != "" && chdir(options.directory.c_str()) != 0)
+        goto failed;
+
+    for(auto &var:options.environment)
+    {
+        size_t eqpos = var.find('=');
+        if(eqpos != std::string::npos)
+            setenv(var.substr(0, eqpos).c_str(), var.substr(eqpos + 1).c_str(), 1);
+    }
+
+    if(options.output_file != "")
+    {
+        int fd = open(options.output_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(fd < 0)
+            goto failed;
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    if(capturefd >= 0)
+        dup2(capturefd, STDOUT_FILENO);
+
+    execvp(cargv[0], cargv.data());
+
+failed:
+    err = errno;
+    if(write(errorfd, &err, sizeof err) < 0) {}
+    _exit(127);
+}
+
+int run_process(const std::vector<std::string> &argv, const process_options &options)
+{
+    int errorpipe[2], capturepipe[2] = {-1, -1};
+
+    bool capturing = options.capture || options.output_filter;
+
+    if(stop_requested)
+        return process_aborted;
+    if(argv.empty() || pipe2(errorpipe, O_CLOEXEC) != 0)
+        return process_not_started;
+    if(capturing && pipe2(capturepipe, O_CLOEXEC) != 0)
+    {
+        close(errorpipe[0]);
+        close(errorpipe[1]);
+        return process_not_started;
+    }
+    if(capturepipe[0] >= 0)
+        fcntl(capturepipe[0], F_SETFL, O_NONBLOCK); // read whatever is there while also watching for the exit
+
+    std::cout.flush(); // or the child's output overtakes ours
+
+    double start = profile_now();
+    pid_t pid = fork();
+
+    if(pid == 0)
+        exec_child(argv, options, capturepipe[1], errorpipe[1]);
+
+    close(errorpipe[1]);
+    if(capturepipe[1] >= 0)
+        close(capturepipe[1]);
+
+    int err = 0;
+    bool exec_failed = pid < 0 || read(errorpipe[0], &err, sizeof err) == sizeof err; // EOF means exec() worked
+    close(errorpipe[0]);
+
+    if(exec_failed)
+    {
+        if(pid > 0)
+            waitpid(pid, NULL, 0);
+        if(capturepipe[0] >= 0)
+            close(capturepipe[0]);
+        std::cout << "Error: could not run '" << argv[0] << "': " << strerror(pid < 0 ? errno : err) << std::endl;
+        return process_not_started;
+    }
+
+    int status = 0;
+    struct rusage usage = {};
+
+    if(options.timeout <= 0 && capturepipe[0] < 0)
+    {
+        // the common case, nothing to do but wait, unless a signal has asked for it to be stopped
+        while(wait4(pid, &status, 0, &usage) < 0 && errno == EINTR)
+        {
+            if(stop_requested)
+            {
+                stop_process(pid, status, usage);
+                return finished(argv, start, process_aborted, usage);
+            }
+        }
+        return finished(argv, start, exit_status(status), usage);
+    }
+
+    int pidfd = open_pidfd(pid);
+    int waited_ms = 0;
+    int result = 0; // or process_timed_out/process_aborted
+    char buffer[4096];
+
+    for(;;)
+    {
+        if(wait4(pid, &status, WNOHANG, &usage) == pid)
+            break;
+        if(stop_requested)
+        {
+            stop_process(pid, status, usage);
+            result = process_aborted;
+            break;
+        }
+
+        int timeout = -1;
+        if(options.timeout > 0)
+            timeout = std::max(0, options.timeout * 1000 - waited_ms);
+        if(pidfd < 0 && (timeout < 0 || timeout > 20))
+            timeout = 20; // no pidfd (older kernel), check back regularly instead
+
+        if(options.timeout > 0 && waited_ms >= options.timeout * 1000)
+        {
+            std::cout << "\nError: '" << argv[0] << "' took longer than " << options.timeout << " seconds, stopping it" << std::endl;
+            stop_process(pid, status, usage);
+            result = process_timed_out;
+            break;
+        }
+
+        struct pollfd fds[2];
+        int nfds = 0;
+        if(pidfd >= 0)
+            fds[nfds++] = {pidfd, POLLIN, 0};
+        if(capturepipe[0] >= 0)
+            fds[nfds++] = {capturepipe[0], POLLIN, 0};
+
+        struct timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        poll(fds, nfds, timeout);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        waited_ms += (after.tv_sec - before.tv_sec) * 1000 + (after.tv_nsec - before.tv_nsec) / 1000000;
+
+        if(capturepipe[0] >= 0)
+        {
+            ssize_t n = read(capturepipe[0], buffer, sizeof buffer);
+            if(n > 0 && !take_output(options, buffer, n))
+            {
+                stop_process(pid, status, usage);
+                result = process_aborted;
+                break;
+            }
+            else if(n == 0 || (n < 0 && errno != EAGAIN))
+            {
+                close(capturepipe[0]); // the program closed its end, only the exit is left to wait for
+                capturepipe[0] = -1;
+            }
+        }
+    }
+
+    if(capturepipe[0] >= 0)
+    {
+        // whatever is still in the pipe
+        ssize_t n;
+        while(result == 0 && (n = read(capturepipe[0], buffer, sizeof buffer)) > 0)
+        {
+            if(!take_output(options, buffer, n))
+                result = process_aborted; // too late to stop it, but the caller still wants to know
+        }
+        close(capturepipe[0]);
+    }
+    if(pidfd >= 0)
+        close(pidfd);
+
+    return finished(argv, start, result != 0 ? result : exit_status(status), usage);
+}
+
+pid_t spawn_detached(const std::vector<std::string> &argv)
+{
+    // fork twice so the program is adopted by init rather than left as a zombie of ours, and pass its pid back up a pipe
+    int pidpipe[2];
+
+    if(argv.empty() || pipe2(pidpipe, O_CLOEXEC) != 0)
+        return -1;
+
+    std::cout.flush();
+
+    pid_t middle = fork();
+
+    if(middle == 0)
+    {
+        pid_t pid = fork();
+
+        if(pid == 0)
+        {
+            setsid(); // don't die with the terminal texbuild was started from
+            // nor hold on to texbuild's output, or whatever is reading it (an editor, the daemon) waits for the viewer to close
+            int devnull = open("/dev/null", O_RDWR);
+            if(devnull >= 0)
+            {
+                dup2(devnull, STDIN_FILENO);
+                dup2(devnull, STDOUT_FILENO);
+                dup2(devnull, STDERR_FILENO);
+                close(devnull);
+            }
+
+            std::vector<char *> cargv;
+            for(auto &arg:argv)
+                cargv.push_back(const_cast<char *>(arg.c_str()));
+            cargv.push_back(NULL);
+
+            execvp(cargv[0], cargv.data());
+            _exit(127);
+        }
+        if(write(pidpipe[1], &pid, sizeof pid) < 0) {}
+        _exit(0);
+    }
+
+    close(pidpipe[1]);
+
+    pid_t pid = -1;
+    if(middle < 0 || read(pidpipe[0], &pid, sizeof pid) != sizeof pid)
+        pid = -1;
+    close(pidpipe[0]);
+
+    if(middle > 0)
+        waitpid(middle, NULL, 0);
+    return pid;
+}
+
+#endif
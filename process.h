@@ -0,0 +1,47 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+#include <csignal>
+
+#ifdef SYSTEM_IS_LINUX
+
+// run_process returns the program's exit status, 128 + the signal number if it was killed, or one of these
+const int process_not_started = -1; // fork() or exec() failed, e.g. the program doesn't exist
+const int process_timed_out = -2;
+const int process_aborted = -3; // the output filter asked for it to be stopped, or stop_requested was set
+
+struct process_options
+{
+    std::string directory;                  // working directory for the program, if not texbuild's own
+    std::vector<std::string> environment;   // NAME=value pairs added to (or replacing in) texbuild's environment
+    int timeout;                            // seconds before the program is killed, 0 to wait forever
+    std::string output_file;                // if set, stdout and stderr are written here instead of the terminal
+    std::string *capture;                   // if set, stdout is collected in here instead
+
+    // if set, stdout is handed to this a chunk at a time as it arrives instead, returning false stops the program
+    std::function<bool(const char *, size_t)> output_filter;
+
+    process_options() : timeout(0), capture(NULL) {}
+};
+
+int run_process(const std::vector<std::string> &argv, const process_options &options = process_options());
+
+// set from a signal handler to stop whatever run_process is waiting on, and everything after it
+extern volatile sig_atomic_t stop_requested;
+
+// starts a program that outlives texbuild, such as the viewer, returning its pid (or -1)
+pid_t spawn_detached(const std::vector<std::string> &argv);
+
+#endif
+
+// splits an options string into separate arguments, e.g. '-a "b c"' gives {"-a", "b c"}
+std::vector<std::string> split_arguments(const std::string &s);
+std::string join_arguments(const std::vector<std::string> &argv); // quoted where necessary, for printing
+
+#endif
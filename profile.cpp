@@ -0,0 +1,154 @@
+#include "profile.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef SYSTEM_IS_LINUX
+    #include <unistd.h>
+#endif
+
+const char *profile_engine = "engine", *profile_bib = "bib", *profile_process = "process";
+
+struct profile_event
+{
+    std::string name;
+    const char *category;
+    double start, end; // microseconds
+    std::vector<std::pair<std::string, std::string> > args;
+};
+
+static std::vector<profile_event> events;
+static const std::chrono::steady_clock::time_point profile_epoch = std::chrono::steady_clock::now();
+
+double profile_now()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - profile_epoch).count();
+}
+
+void profile_record(const std::string &name, const char *category, double start, double end,
+                    const std::vector<std::pair<std::string, std::string> > &args)
+{
+    if(!profile_build)
+        return;
+
+    profile_event event = {name, category, start, end, args};
+    events.push_back(event);
+}
+
+profile_scope::profile_scope(const std::string &name, const char *category) : name(name), category(category), start(profile_now())
+{
+}
+
+profile_scope::~profile_scope()
+{
+    profile_record(name, category, start, profile_now(), args);
+}
+
+void profile_scope::arg(const std::string &key, const std::string &value)
+{
+    args.push_back(std::make_pair(key, value));
+}
+
+static std::string json_string(const std::string &s)
+{
+    std::string out = "\"";
+
+    for(char c:s)
+    {
+        if(c == '"' || c == '\\')
+            out += std::string("\\") + c;
+        else if((unsigned char)c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof escaped, "\\u%04x", c);
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+bool write_profile(const std::string &path)
+{
+    // the trace event format, "X" being an event with a start and a duration
+    std::ofstream ofile(path);
+    int pid = 1;
+
+    #ifdef SYSTEM_IS_LINUX
+    pid = getpid();
+    #endif
+
+    ofile << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    for(size_t i = 0; i < events.size(); i++)
+    {
+        const profile_event &event = events[i];
+
+        ofile << "  {\"name\": " << json_string(event.name) << ", \"cat\": " << json_string(event.category)
+              << ", \"ph\": \"X\", \"pid\": " << pid << ", \"tid\": 1" << std::fixed << std::setprecision(0)
+              << ", \"ts\": " << event.start << ", \"dur\": " << event.end - event.start << ", \"args\": {";
+
+        for(size_t j = 0; j < event.args.size(); j++)
+            ofile << (j ? ", " : "") << json_string(event.args[j].first) << ": " << json_string(event.args[j].second);
+
+        ofile << "}}" << (i + 1 < events.size() ? "," : "") << "\n";
+    }
+    ofile << "]}\n";
+
+    ofile.close();
+    return !ofile.fail();
+}
+
+static double arg_number(const profile_event &event, const std::string &key)
+{
+    for(auto &arg:event.args)
+    {
+        if(arg.first == key)
+            return atof(arg.second.c_str());
+    }
+    return 0;
+}
+
+std::string profile_summary()
+{
+    double first = 0, last = 0, engine = 0, bib = 0, children = 0, cpu = 0, peak_rss = 0;
+    int passes = 0;
+
+    for(auto &event:events)
+    {
+        double duration = event.end - event.start;
+
+        if(&event == &events.front() || event.start < first)
+            first = event.start;
+        last = std::max(last, event.end);
+
+        if(strcmp(event.category, profile_engine) == 0)
+        {
+            engine += duration;
+            passes++;
+        }
+        else if(strcmp(event.category, profile_bib) == 0)
+            bib += duration;
+        else if(strcmp(event.category, profile_process) == 0)
+        {
+            children += duration;
+            cpu += arg_number(event, "user ms") + arg_number(event, "system ms");
+            peak_rss = std::max(peak_rss, arg_number(event, "peak RSS kB"));
+        }
+    }
+
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(2)
+            << "Profile: " << (last - first) / 1e6 << "s total, engine " << engine / 1e6 << "s over " << passes
+            << (passes == 1 ? " pass" : " passes") << ", bib engine " << bib / 1e6 << "s, texbuild "
+            << std::max(0.0, last - first - children) / 1e6 << "s, child CPU " << cpu / 1e3 << "s, peak RSS "
+            << std::setprecision(0) << peak_rss / 1024 << "MB";
+    return summary.str();
+}
@@ -0,0 +1,39 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// texbuild --profile, how long each phase of a build took, written out as a Chrome trace (chrome://tracing or
+// ui.perfetto.dev) along with a one line summary. nothing is recorded unless profile_build is set
+
+// times everything from its construction to the end of the enclosing block, nested scopes show up nested
+class profile_scope
+{
+public:
+    profile_scope(const std::string &name, const char *category);
+    ~profile_scope();
+
+    void arg(const std::string &key, const std::string &value); // shown when the event is clicked on
+
+private:
+    std::string name;
+    const char *category;
+    double start;
+    std::vector<std::pair<std::string, std::string> > args;
+};
+
+// categories the summary adds up, anything else counts as texbuild's own time
+extern const char *profile_engine, *profile_bib, *profile_process;
+
+double profile_now(); // microseconds since texbuild started
+void profile_record(const std::string &name, const char *category, double start, double end,
+                    const std::vector<std::pair<std::string, std::string> > &args);
+
+bool write_profile(const std::string &path); // false if the file can't be written
+std::string profile_summary();
+
+#endif
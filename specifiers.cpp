@@ -0,0 +1,276 @@
+#include "specifiers.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+std::string dont_use_specvalue = "none"; // this value in a specifier-value pair indicates that the default value should not be used
+
+void sanitise_path(std::string &path)
+{
+    /*
+    Both CreateProcess for windows and Unix-like systems prefer a forward slash (/) instead of a backslash (\) as a separator in file paths
+    this function replaces all backslashes in a string with forward slashes, and squashes any troublesome runs of slashes into one
+    done in place in a single pass, paths can be long and this runs on every specifier of every file
+    */
+    size_t out = 0;
+
+    for(size_t i = 0; i < path.size(); i++)
+    {
+        char c = path[i] == '\\' ? '/' : path[i];
+
+        if(c == '/' && out > 0 && path[out - 1] == '/')
+            continue; // already have a slash here
+        path[out++] = c;
+    }
+    path.resize(out);
+}
+
+bool file_exists(const std::string name)
+{
+    // checks if a file exists
+    std::ifstream f(name.c_str());
+    return f.good();
+}
+
+std::vector<std::string> explode(std::string s, char c)
+{
+    /*
+    splits a string on c
+    for example, explode("list,of,words",',') returns {"list","of","words"}
+    function ignores any instances of c inside double quotes
+    */
+
+	std::string buffer; // stores current word
+	std::vector<std::string> v; // output
+	bool track = true; // keeps track of whether the loop is in a double quote pair or not
+
+	for(auto n:s) // iterate through s
+	{
+	    if(n == '"')
+            track = !track; // we have just entered/left a quote pair
+	    if(!track)
+        {
+            buffer += n; // if in quote pair, add n to buffer regardless
+            continue; // skip any further comparisons
+        }
+		if(n != c)
+            buffer += n; // if n is not c, add to buffer
+        else if(n == c && buffer != "" && track)
+        {
+            v.push_back(buffer); // if n is c, add buffer to output
+            buffer = ""; // reset buffer
+        }
+	}
+	if(buffer !=  "") // if there is something in the buffer
+        v.push_back(buffer); // add whatever buffer is to output
+
+	return v;
+}
+
+std::string mod_abs_path(std::string abspath, std::string relpath)
+{
+    // abspath must have a '\' at the end
+    while(relpath.substr(0,3) == "../") // if relative path has 'go up a level', go up a level
+    {
+        size_t pos = abspath.find_last_of('/', abspath.size() - 2);
+
+        abspath.erase(abspath.begin()+pos, abspath.end() - 1); // by deleting the last part of the absolute path
+
+        relpath.erase(0,3); // remove the up one level specifier
+    }
+    std::string buffer = abspath + relpath; // add the relative path to the absolute path
+    return buffer;
+}
+
+// the keys, in specifier_key order
+static constexpr specifier_info specifier_table[] = {
+    {spec_master,     "master",     "master file",                     &specifiers::master},
+    {spec_engine,     "engine",     "LaTeX engine",                    &specifiers::engine},
+    {spec_bib,        "bib",        "bibliography engine",             &specifiers::bibengine},
+    {spec_options,    "options",    "LaTeX compiler options",          &specifiers::options},
+    {spec_biboptions, "biboptions", "bibliography engine options",     &specifiers::biboptions},
+    {spec_outext,     "outext",     "output file extension",           &specifiers::outext},
+    {spec_openwith,   "openwith",   "program to open output with",     &specifiers::openwith},
+    {spec_outoptions, "outoptions", "output viewer options",           &specifiers::outopts},
+    {spec_maxpasses,  "maxpasses",  "maximum number of engine passes", &specifiers::maxpasses},
+    {spec_index,      "index",      "index processor",                 &specifiers::index},
+    {spec_glossary,   "glossary",   "glossary processor",              &specifiers::glossary},
+    {spec_nomencl,    "nomencl",    "nomenclature processor",          &specifiers::nomencl},
+    {spec_focus,      "focus",      "focused builds",                  &specifiers::focus},
+    {spec_variants,   "variants",   "build variants",                  &specifiers::variants},
+};
+static_assert(sizeof specifier_table / sizeof specifier_table[0] == specifier_key_count, "a key is missing from specifier_table");
+
+const specifier_info *find_specifier(std::string_view name)
+{
+    for(auto &info:specifier_table)
+    {
+        if(info.name == name)
+            return &info;
+    }
+    return NULL;
+}
+
+const specifier_info &specifier_for(specifier_key key)
+{
+    return specifier_table[key];
+}
+
+const char *check_specifier(const specifier_info &info, std::string_view value)
+{
+    if(value.empty())
+        return "has no value, use 'none' to turn a default off";
+
+    switch(info.key)
+    {
+    case spec_engine:
+    case spec_bib:
+    case spec_index:
+    case spec_glossary:
+    case spec_nomencl:
+        // these go into the command line as they are, so anything more than a program name breaks it
+        if(value.find_first_of(" \t\"") != std::string_view::npos)
+            return "must be a program name without spaces or quotes";
+        break;
+    case spec_outext:
+        if(value != dont_use_specvalue && value[0] != '.')
+            return "must start with a dot, e.g. .pdf";
+        break;
+    case spec_focus:
+        if(value != "yes" && value != "no" && value != dont_use_specvalue)
+            return "must be yes or no";
+        break;
+    case spec_maxpasses:
+        if(value.find_first_not_of("0123456789") != std::string_view::npos)
+            return "must be a whole number";
+        break;
+    case spec_variants:
+    {
+        if(value == dont_use_specvalue)
+            break;
+
+        // the name ends up in the job name and a directory name, so nothing that needs quoting
+        auto variants = split_variants(value);
+        for(size_t i = 0; i < variants.size(); i++)
+        {
+            const std::string &name = variants[i].first;
+
+            if(name.empty() || name.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-") != std::string::npos)
+                return "must be name or name:TeX entries separated by |, names made of letters, digits, - and _";
+            for(size_t j = 0; j < i; j++)
+            {
+                if(variants[j].first == name)
+                    return "names the same variant twice";
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return NULL;
+}
+
+bool read_first_line(const std::string &path, std::string &line)
+{
+    // masters are found by reading the first line of every file on the way, often thousands of them,
+    // so this reads a single bounded block rather than however much getline decides to buffer
+    char buffer[max_first_line];
+    std::ifstream ifile;
+
+    ifile.rdbuf()->pubsetbuf(NULL, 0); // unbuffered, the read below goes straight into buffer
+    ifile.open(path, std::ios::binary);
+    if(!ifile.is_open())
+        return false;
+
+    ifile.read(buffer, sizeof buffer);
+    std::string_view text(buffer, ifile.gcount());
+
+    line.assign(text.substr(0, text.find('\n')));
+    return true;
+}
+
+std::string_view trim_whitespace(std::string_view s)
+{
+    size_t start = s.find_first_not_of(" \t\r");
+    if(start == std::string_view::npos)
+        return std::string_view();
+
+    return s.substr(start, s.find_last_not_of(" \t\r") - start + 1);
+}
+
+std::vector<std::pair<std::string, std::string> > split_variants(std::string_view value)
+{
+    // the quotes are only there to keep a ; in the TeX code from ending the specifier
+    if(value.size() >= 2 && value.front() == '"' && value.back() == '"')
+        value = value.substr(1, value.size() - 2);
+
+    std::vector<std::pair<std::string, std::string> > variants;
+
+    while(!value.empty())
+    {
+        std::string_view entry = value.substr(0, value.find('|'));
+        size_t colon = entry.find(':');
+
+        value.remove_prefix(std::min(value.size(), entry.size() + 1));
+
+        std::string_view name = trim_whitespace(entry.substr(0, colon));
+        std::string_view code = colon == std::string_view::npos ? std::string_view() : trim_whitespace(entry.substr(colon + 1));
+        variants.emplace_back(std::string(name), std::string(code));
+    }
+    return variants;
+}
+
+void parse_specifiers(std::string_view line, specifiers &spec)
+{
+    // one pass over the line, slicing it into views, the only copies made are the values that get stored
+    spec = specifiers();
+
+    if(line.substr(0, 3) == "\xEF\xBB\xBF")
+        line.remove_prefix(3); // byte order mark, some windows editors insist
+
+    if(line.empty() || line[0] != '%')
+        return; // not a comment, so no specifiers
+
+    size_t start = 1;
+    bool quoted = false;
+
+    for(size_t i = 1; i <= line.size(); i++) // for each specifier-value pair...
+    {
+        if(i < line.size() && line[i] == '"')
+            quoted = !quoted; // semicolons inside quotes belong to the value
+        if(i < line.size() && (quoted || line[i] != ';'))
+            continue;
+
+        std::string_view pair = trim_whitespace(line.substr(start, i - start));
+        start = i + 1;
+
+        if(pair.empty())
+            continue;
+
+        size_t column = pair.data() - line.data() + 1; // where the pair starts, counting from 1
+
+        size_t equals = pair.find('=');
+        const specifier_info *info = equals == std::string_view::npos ? NULL : find_specifier(trim_whitespace(pair.substr(0, equals)));
+
+        if(info == NULL) // that's all this program accepts
+        {
+            std::cout << "Unknown specifier key '" << pair << "' at column " << column << ", ignoring..." << std::endl;
+            continue;
+        }
+
+        std::string_view value = trim_whitespace(pair.substr(equals + 1));
+
+        if(const char *problem = check_specifier(*info, value))
+        {
+            std::cout << "Warning: " << info->name << "= at column " << column << " " << problem << ", ignoring '" << pair << "'" << std::endl;
+            continue;
+        }
+
+        if(info->key != spec_master)
+            spec.otherargs = true;
+        (spec.*(info->field)).assign(value);
+        std::cout << "Found specifier for " << info->description << ": '" << value << "'" << std::endl;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef SPECIFIERS_H
+#define SPECIFIERS_H
+
+#include "texbuild.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+// the specifier-value pairs on the first line of a file, e.g. %engine=xelatex;bib=biber;master=../main.tex
+struct specifiers
+{
+    std::string master, engine, options, bibengine, biboptions, outext, openwith, outopts, maxpasses;
+    std::string index, glossary, nomencl; // programs for the index, glossaries and nomenclature, e.g. makeindex
+    std::string focus; // yes to build only the \include'd file a build was started from, rather than the whole master
+    std::string variants; // name:TeX|name:TeX..., the master is built once for each, all at the same time
+    bool otherargs; // set if anything other than master is specified, which master= makes redundant
+
+    specifiers() : otherargs(false) {}
+};
+
+// every key texbuild knows, shared by the first line and config.txt
+enum specifier_key {spec_master, spec_engine, spec_bib, spec_options, spec_biboptions, spec_outext, spec_openwith,
+                    spec_outoptions, spec_maxpasses, spec_index, spec_glossary, spec_nomencl, spec_focus, spec_variants,
+                    specifier_key_count};
+
+struct specifier_info
+{
+    specifier_key key;
+    std::string_view name; // what goes before the =
+    std::string_view description; // what the messages call it
+    std::string specifiers::*field;
+};
+
+const specifier_info *find_specifier(std::string_view name); // NULL if there is no such key
+const specifier_info &specifier_for(specifier_key key);
+
+// what is wrong with value for this key, or NULL if nothing is
+const char *check_specifier(const specifier_info &info, std::string_view value);
+
+// the first line of path, without its line ending, reading no more than the first max_first_line bytes of the file
+const size_t max_first_line = 4096;
+bool read_first_line(const std::string &path, std::string &line); // false if the file can't be read
+
+void parse_specifiers(std::string_view line, specifiers &spec); // line is the first line as read, % and all
+
+// the name and TeX code of each entry in a variants= value, in order, e.g. slides|handout:\PassOptionsToClass{handout}{beamer}
+std::vector<std::pair<std::string, std::string> > split_variants(std::string_view value);
+
+std::string_view trim_whitespace(std::string_view s); // spaces, tabs and carriage returns at either end
+std::string mod_abs_path(std::string abspath, std::string relpath); // abspath must end in a slash
+
+#endif
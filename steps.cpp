@@ -0,0 +1,475 @@
+#include "steps.h"
+#include "passes.h"
+#include "fileutil.h"
+#include "profile.h"
+#include "metrics.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static const char *profile_aux = "aux"; // --profile category for everything but the bib engine
+
+enum step_state { step_waiting, step_running, step_done };
+
+static std::string stamp_path(const build_job &job, const aux_step &step)
+{
+    return config_path + "cache/" + job_key(job) + "." + step.name;
+}
+
+static void read_stamp(const build_job &job, aux_step &step)
+{
+    // <inputs fingerprint> <hash of the outputs made from them>
+    std::ifstream ifile(stamp_path(job, step));
+    std::string first, second;
+
+    step.have_stamp = ifile >> first >> second && parse_hex64(first, step.stamp_inputs) && parse_hex64(second, step.stamp_outputs);
+}
+
+static void write_stamp(const build_job &job, const aux_step &step)
+{
+    std::string path = stamp_path(job, step);
+
+    if(!make_directories(config_path + "cache"))
+        return;
+
+    std::ofstream ofile(path + ".tmp");
+    ofile << hex64(step.stamp_inputs) << " " << hex64(step.stamp_outputs) << "\n";
+    ofile.close();
+
+    if(ofile)
+        rename((path + ".tmp").c_str(), path.c_str());
+}
+
+static uint64_t files_fingerprint(const build_job &job, const std::vector<std::string> &argv, const std::vector<std::string> &exts, bool *any = NULL)
+{
+    // the command and the files it reads or writes, a missing file hashes differently to an empty one
+    uint64_t h = hash_string(join_arguments(argv)), filehash;
+
+    if(any)
+        *any = false;
+
+    for(auto &ext:exts)
+    {
+        if(hash_file(join_path(job.outdir, job.jobname + ext), filehash))
+        {
+            h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+            if(any)
+                *any = true;
+        }
+        else
+            h = hash_string("missing", h);
+    }
+    return h;
+}
+
+static uint64_t glossary_fingerprint(const build_job &job)
+{
+    // makeglossaries takes its settings from the .aux (bib2gls its entries too) as well as reading the .glo/.acn/.slo
+    static const char *prefixes[] = {"\\@gls", "\\@istfilename", "\\@newglossary", "\\@xdy", "\\glsxtr"};
+    uint64_t h = files_fingerprint(job, job.glossary_argv, {".glo", ".acn", ".slo"});
+    std::ifstream ifile(join_path(job.outdir, job.jobname + ".aux"));
+    std::string line;
+
+    while(getline(ifile, line))
+    {
+        for(auto prefix:prefixes)
+        {
+            if(line.compare(0, strlen(prefix), prefix) == 0)
+            {
+                h = hash_string(line + "\n", h);
+                break;
+            }
+        }
+    }
+    return h;
+}
+
+std::vector<aux_step> auxiliary_steps(const build_job &job)
+{
+    std::vector<aux_step> steps;
+
+    // they all run next to the .aux, so if that isn't the source directory they need telling where the sources are
+    process_options options;
+    options.directory = job.outdir;
+    options.timeout = process_timeout;
+
+    if(job.outdir != job.dir)
+    {
+        for(const char *var:{"BIBINPUTS", "INDEXSTYLE"})
+        {
+            const char *value = getenv(var);
+            options.environment.push_back(std::string(var) + "=" + job.dir + ":" + (value ? value : ""));
+        }
+    }
+
+    // none of these read each other's output, so none of them have to wait for another, but a step that did
+    // would list it in after and only start once it was done
+    if(!job.bib_argv.empty())
+    {
+        aux_step step = {"bib", "bibliography manager", job.bib_argv, options, {}, "", [&job]() { return citation_fingerprint(job); },
+                         {".bbl"}, job.bibengine == "bibtex"};
+        steps.push_back(step);
+    }
+    if(!job.index_argv.empty())
+    {
+        aux_step step = {"index", "index processor", job.index_argv, options, {}, ".idx",
+                         [&job]() { return files_fingerprint(job, job.index_argv, {".idx"}); }, {".ind"}, false};
+        steps.push_back(step);
+    }
+    if(!job.glossary_argv.empty())
+    {
+        // bib2gls works from the .aux alone, makeglossaries has nothing to do until there is a .glo
+        aux_step step = {"glossary", "glossary processor", job.glossary_argv, options, {}, job.glossary == "bib2gls" ? ".aux" : ".glo",
+                         [&job]() { return glossary_fingerprint(job); }, {".gls", ".acr", ".sls", ".glstex"}, false};
+        steps.push_back(step);
+    }
+    if(!job.nomencl_argv.empty())
+    {
+        aux_step step = {"nomencl", "nomenclature processor", job.nomencl_argv, options, {}, ".nlo",
+                         [&job]() { return files_fingerprint(job, job.nomencl_argv, {".nlo"}); }, {".nls"}, false};
+        steps.push_back(step);
+    }
+
+    for(auto &step:steps)
+        read_stamp(job, step);
+    return steps;
+}
+
+static uint64_t shared_citation_fingerprint(const build_job &job)
+{
+    // the variants' bib commands differ only in the job name and the directory it runs in
+    build_job generic = job;
+    std::vector<std::string> argv;
+
+    for(auto arg:job.bib_argv)
+    {
+        size_t at = arg.find(job.outdir);
+        if(at != std::string::npos)
+            arg.replace(at, job.outdir.size(), "$OUT");
+        argv.push_back(arg == job.jobname ? "$JOB" : arg);
+    }
+    generic.bibcall = join_arguments(argv);
+    return citation_fingerprint(generic);
+}
+
+static int run_step(const build_job &job, const aux_step &step)
+{
+    if(step.name != "bib" || job.variant == "")
+        return run_process(step.argv, step.options);
+
+    // variants citing the same things from the same databases would each make the same .bbl, so the first to get
+    // here makes it and leaves a copy for the others. one file per master, headed by what it was made from
+    std::string shared = config_path + "cache/" + hex64(hash_string(job.texpath)) + ".variants.bbl";
+    std::string bbl = join_path(job.outdir, job.jobname + ".bbl"), key = hex64(shared_citation_fingerprint(job)) + "\n", contents;
+
+    make_directories(config_path + "cache");
+    int lockfd = open((shared + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(lockfd >= 0)
+        flock(lockfd, LOCK_EX); // the other variants are after the same file right now
+
+    int rc = 0;
+    bool copied = false;
+
+    if(read_whole_file(shared, contents) && contents.compare(0, key.size(), key) == 0)
+    {
+        std::ofstream ofile(bbl, std::ios::binary);
+        ofile << contents.substr(key.size());
+        ofile.close();
+        copied = !ofile.fail();
+    }
+
+    if(copied)
+        std::cout << "Another variant has made the bibliography from the same citations, using its .bbl" << std::endl;
+    else
+    {
+        rc = run_process(step.argv, step.options);
+
+        if((rc == 0 || (rc == 1 && step.exit_1_is_warning)) && read_whole_file(bbl, contents))
+        {
+            std::ofstream ofile(shared + ".tmp", std::ios::binary);
+            ofile << key << contents;
+            ofile.close();
+
+            if(ofile)
+                rename((shared + ".tmp").c_str(), shared.c_str());
+        }
+    }
+
+    if(lockfd >= 0)
+        close(lockfd);
+    return rc;
+}
+
+static bool step_has_work(const build_job &job, const aux_step &step)
+{
+    // bib= may well be a default from config.txt, set for documents that cite nothing
+    if(step.name == "bib" && !citations_to_process(job))
+        return false;
+    return step.needs == "" || file_exists(join_path(job.outdir, job.jobname + step.needs));
+}
+
+bool auxiliary_steps_pending(const build_job &job, const std::vector<aux_step> &steps)
+{
+    // one the document uses that has never made anything for it runs after the first pass, whatever that pass does
+    for(auto &step:steps)
+    {
+        if(!step.have_stamp && step_has_work(job, step))
+            return true;
+    }
+    return false;
+}
+
+// a step that has been started, and what things looked like beforehand
+struct started_step
+{
+    size_t index;
+    uint64_t inputs, outputs;
+    bool had_outputs;
+    std::string log;    // where its output goes while it runs alongside others
+    double start;
+};
+
+static bool dependencies_done(const std::vector<aux_step> &steps, const std::vector<step_state> &state, size_t i)
+{
+    for(auto &name:steps[i].after)
+    {
+        for(size_t j = 0; j < steps.size(); j++)
+        {
+            if(steps[j].name == name && state[j] != step_done)
+                return false;
+        }
+    }
+    return true;
+}
+
+static int finish_step(const build_job &job, aux_step &step, const started_step &started, int rc, bool &rerun)
+{
+    // bibtex exits with 1 when there were only warnings, anything more is a real failure
+    if(rc != 0 && !(rc == 1 && step.exit_1_is_warning))
+    {
+        std::cout << "\nError: " << step.label << " call failed\n" << std::endl;
+        return rc;
+    }
+
+    bool have_outputs;
+    uint64_t outputs = files_fingerprint(job, step.argv, step.outputs, &have_outputs);
+
+    // what the pass just read in is exactly what the step would have made, so there is nothing new to read
+    if(started.had_outputs && have_outputs && outputs == started.outputs)
+        std::cout << "\nOutput of the " << step.label << " is unchanged, no extra pass needed for it" << std::endl;
+    else
+        rerun = true; // the new output only gets read in on the next pass
+
+    step.stamp_inputs = started.inputs;
+    step.stamp_outputs = outputs;
+    step.have_stamp = have_outputs;
+    if(have_outputs)
+        write_stamp(job, step);
+    return 0;
+}
+
+static pid_t start_step(const build_job &job, const aux_step &step, started_step &started)
+{
+    // its output goes to a log until it has finished, so several steps' output doesn't end up interleaved
+    started.log = join_path(job.outdir, job.jobname + "." + step.name + ".texbuild.log");
+
+    std::cout.flush(); // otherwise the child prints whatever is still buffered a second time
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        int fd = open(started.log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        int rc = run_step(job, step);
+
+        std::cout.flush();
+        _exit(rc < 0 ? 255 : rc);
+    }
+    return pid;
+}
+
+int run_auxiliary_steps(const build_job &job, std::vector<aux_step> &steps, bool &rerun)
+{
+    std::vector<step_state> state(steps.size(), step_waiting);
+    std::map<pid_t, started_step> running; // never more than the four kinds of step, so no need to limit it
+    int failed = 0;
+
+    for(;;)
+    {
+        if(stop_requested)
+        {
+            // superseded, nothing more is started and the steps running are stopped rather than waited for. they
+            // share our SIGUSR1 handler, so passing it on has each one stop its program the way we stop the engine
+            for(auto &entry:running)
+                kill(entry.first, SIGUSR1);
+
+            while(!running.empty())
+            {
+                int status;
+                pid_t pid = waitpid(-1, &status, 0);
+
+                if(pid < 0 && errno != EINTR)
+                    break;
+                if(pid < 0 || running.find(pid) == running.end())
+                    continue;
+
+                remove(running[pid].log.c_str());
+                running.erase(pid);
+            }
+            return process_aborted;
+        }
+
+        // everything whose dependencies are done is either up to date or ready to start, and a step found to be
+        // up to date may in turn let others through
+        std::vector<started_step> ready;
+
+        for(bool changed = true; changed && !failed;)
+        {
+            changed = false;
+
+            for(size_t i = 0; i < steps.size(); i++)
+            {
+                if(state[i] != step_waiting || !dependencies_done(steps, state, i))
+                    continue;
+
+                aux_step &step = steps[i];
+                started_step started = {i, 0, 0, false, "", 0};
+
+                if(!step_has_work(job, step))
+                {
+                    state[i] = step_done; // the document doesn't use it (yet)
+                    changed = true;
+                    continue;
+                }
+
+                started.inputs = step.inputs();
+                started.outputs = files_fingerprint(job, step.argv, step.outputs, &started.had_outputs);
+
+                // the outputs being missing or not what the step last made means someone else has been at them
+                if(step.have_stamp && started.had_outputs && started.outputs == step.stamp_outputs && started.inputs == step.stamp_inputs)
+                {
+                    state[i] = step_done;
+                    changed = true;
+                    continue;
+                }
+
+                state[i] = step_running;
+                ready.push_back(started);
+            }
+        }
+
+        if(ready.size() == 1 && running.empty() && !failed)
+        {
+            // on its own, so it can have the terminal to itself
+            aux_step &step = steps[ready[0].index];
+            int rc;
+
+            std::cout << "\nInputs have changed, running " << step.label << "...\n" << std::endl;
+            {
+                profile_scope timing(step.label, step.name == "bib" ? profile_bib : profile_aux);
+                metrics_timer timer;
+                rc = run_step(job, step);
+                timer.record(step.name);
+            }
+
+            state[ready[0].index] = step_done;
+            failed = finish_step(job, step, ready[0], rc, rerun);
+            continue;
+        }
+
+        for(auto &started:ready)
+        {
+            aux_step &step = steps[started.index];
+
+            if(failed)
+            {
+                state[started.index] = step_done;
+                continue;
+            }
+
+            std::cout << "\nInputs have changed, running " << step.label << " (" << join_arguments(step.argv) << ")..." << std::endl;
+            started.start = profile_now();
+
+            pid_t pid = start_step(job, step, started);
+            if(pid < 0)
+            {
+                std::cout << "Error: fork() failed for the " << step.label << std::endl;
+                state[started.index] = step_done;
+                failed = 1;
+                continue;
+            }
+            running[pid] = started;
+        }
+
+        if(running.empty())
+            break;
+
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+
+        if(pid < 0 && errno != EINTR)
+            break;
+        if(pid < 0 || running.find(pid) == running.end())
+            continue;
+
+        started_step started = running[pid];
+        aux_step &step = steps[started.index];
+        int rc = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        std::string output;
+
+        running.erase(pid);
+        state[started.index] = step_done;
+
+        read_whole_file(started.log, output);
+        remove(started.log.c_str());
+        std::cout << "\n--- " << step.label << " (" << step.argv[0] << ") ---\n" << output << std::flush;
+
+        double end = profile_now();
+        metrics_step(step.name, (end - started.start) / 1000, (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+                     + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0);
+        profile_record(step.label, step.name == "bib" ? profile_bib : profile_aux, started.start, end, {});
+        profile_record(step.argv[0].substr(step.argv[0].find_last_of('/') + 1), profile_process, started.start, end, {
+            {"command", join_arguments(step.argv)},
+            {"exit status", std::to_string(rc)},
+            {"user ms", std::to_string(usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000)},
+            {"system ms", std::to_string(usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000)},
+            {"peak RSS kB", std::to_string(usage.ru_maxrss)}
+        });
+
+        int steprc = finish_step(job, step, started, rc, rerun);
+        if(!failed)
+            failed = steprc;
+    }
+
+    if(!failed && std::find(state.begin(), state.end(), step_waiting) != state.end())
+    {
+        std::cout << "\nError: the auxiliary steps wait on each other, none of them can start\n" << std::endl;
+        return 1;
+    }
+    return failed;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef STEPS_H
+#define STEPS_H
+
+#include "texbuild.h"
+#include "process.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#ifdef SYSTEM_IS_LINUX
+// the programs run between engine passes (bib engine, makeindex, makeglossaries and so on), as a dependency graph.
+// after each pass every step whose inputs have changed is run, those that don't depend on each other at the same time
+struct aux_step
+{
+    std::string name;                   // bib, index, glossary or nomencl, also where its stamp is kept
+    std::string label;                  // what the messages call it
+    std::vector<std::string> argv;
+    process_options options;
+    std::vector<std::string> after;     // names of steps that have to finish before this one starts
+    std::string needs;                  // extension of a file that has to exist for there to be anything to do, if any
+    std::function<uint64_t()> inputs;   // changes whenever the step would produce something different
+    std::vector<std::string> outputs;   // extensions of the files it writes for the next pass to read
+    bool exit_1_is_warning;             // bibtex exits with 1 when there were only warnings
+
+    // what it was last run on and what that made, from config_path/cache/<job_key>.<name>
+    uint64_t stamp_inputs, stamp_outputs;
+    bool have_stamp;
+};
+
+std::vector<aux_step> auxiliary_steps(const build_job &job); // the steps the job asks for, with their stamps read in
+bool auxiliary_steps_pending(const build_job &job, const std::vector<aux_step> &steps); // true if one is bound to run after the next pass
+
+// runs whatever is out of date, sets rerun if anything the next pass reads has changed
+// returns 0, or the exit status of the first step that failed
+int run_auxiliary_steps(const build_job &job, std::vector<aux_step> &steps, bool &rerun);
+#endif
+
+#endif
@@ -0,0 +1,564 @@
+#include "store.h"
+#include "cache.h"
+#include "steps.h"
+#include "fileutil.h"
+#include "profile.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+static const char *manifest_header = "texbuild-store 1";
+static const char *result_header = "texbuild-result 1";
+static const size_t max_manifest_entries = 16; // input sets remembered per key, the oldest are forgotten first
+static const int evict_interval = 10;          // seconds between adding up the local store's size
+
+// what the source and output directories become in anything kept in the store
+static const char *source_placeholder = "$SRC";
+static const char *output_placeholder = "$OUT";
+
+// one set of inputs seen with a key, and the result the build made from them
+struct store_entry
+{
+    std::string result;
+    std::vector<std::pair<uint64_t, std::string> > inputs; // hash, path with the placeholders in
+};
+
+static std::vector<std::string> store_roots()
+{
+    // the local store first, it's the quicker to read
+    std::vector<std::string> roots;
+
+    if(store_root != "")
+        roots.push_back(store_root);
+    if(shared_store != "" && shared_store != store_root)
+        roots.push_back(shared_store);
+    return roots;
+}
+
+static std::string replace_paths(std::string s, const std::string &from, const std::string &to)
+{
+    // whole directories only, /home/me/book mustn't turn /home/me/books/ into $SRCs/
+    if(from == "")
+        return s;
+
+    for(size_t pos = 0; (pos = s.find(from, pos)) != std::string::npos; )
+    {
+        size_t end = pos + from.size();
+
+        if(end < s.size() && std::string("/\"' \n").find(s[end]) == std::string::npos)
+        {
+            pos = end;
+            continue;
+        }
+        s.replace(pos, from.size(), to);
+        pos += to.size();
+    }
+    return s;
+}
+
+static std::string portable_text(const build_job &job, const std::string &s)
+{
+    // the longer first, in case one directory is inside the other
+    if(job.outdir.size() > job.dir.size())
+        return replace_paths(replace_paths(s, job.outdir, output_placeholder), job.dir, source_placeholder);
+    return replace_paths(replace_paths(s, job.dir, source_placeholder), job.outdir, output_placeholder);
+}
+
+static std::string local_text(const build_job &job, const std::string &s)
+{
+    return replace_paths(replace_paths(s, output_placeholder, job.outdir), source_placeholder, job.dir);
+}
+
+static bool write_atomically(const std::string &path, const std::string &contents)
+{
+    // the pid keeps writers on different machines sharing a store out of each other's way
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    std::ofstream ofile(tmp, std::ios::binary);
+
+    ofile.write(contents.data(), contents.size());
+    ofile.close();
+
+    if(ofile && rename(tmp.c_str(), path.c_str()) == 0)
+        return true;
+
+    remove(tmp.c_str());
+    return false;
+}
+
+static uint64_t engine_identity(const std::string &engine, uint64_t h)
+{
+    // the TeX installation's own files are never hashed (see is_distribution_file), so the engine's size and date
+    // stand in for which installation made the output
+    std::string path = engine;
+    struct stat st;
+
+    if(engine.find('/') == std::string::npos)
+    {
+        const char *dirs = getenv("PATH");
+
+        for(auto &dir:explode(dirs ? dirs : "", ':'))
+        {
+            if(dir != "" && stat(join_path(dir, engine).c_str(), &st) == 0)
+            {
+                path = join_path(dir, engine);
+                break;
+            }
+        }
+    }
+
+    if(stat(path.c_str(), &st) == 0)
+    {
+        int64_t identity[2] = {(int64_t)st.st_size, (int64_t)st.st_mtime};
+        h = hash_bytes((const char *)identity, sizeof identity, h);
+    }
+    return h;
+}
+
+static uint64_t direct_key(const build_job &job)
+{
+    // everything known before the build: texbuild, the engine, every command and the master itself
+    uint64_t h = hash_string(std::string("texbuild ") + version), filehash;
+
+    if(!job.comp_argv.empty())
+        h = engine_identity(job.comp_argv[0], h);
+
+    for(auto argv:{&job.comp_argv, &job.bib_argv, &job.index_argv, &job.glossary_argv, &job.nomencl_argv})
+    {
+        h = hash_string("\n", h);
+        for(auto &arg:*argv)
+        {
+            if(arg.compare(0, 5, "-fmt=") != 0) // a format is only a quicker way of reading the preamble
+                h = hash_string(portable_text(job, arg) + "\t", h);
+        }
+    }
+    h = hash_string("\n" + job.outext + "\n", h);
+
+    if(hash_file(job.texpath, filehash))
+        h = hash_bytes((const char *)&filehash, sizeof filehash, h);
+    return h;
+}
+
+static std::vector<std::string> store_inputs(const build_job &job)
+{
+    // what the build read, less what the auxiliary steps made during it, which are results like the .aux
+    std::vector<std::string> inputs = read_recorded_inputs(job);
+    std::set<std::string> generated, seen;
+    std::vector<std::string> result;
+
+    inputs.push_back(job.texpath);
+    for(auto &bib:find_bib_files(job))
+        inputs.push_back(bib);
+
+    for(auto &step:auxiliary_steps(job))
+    {
+        for(auto &ext:step.outputs)
+            generated.insert(normalise_path(join_path(job.outdir, job.jobname + ext)));
+    }
+
+    for(auto &input:inputs)
+    {
+        std::string path = normalise_path(input);
+
+        if(!generated.count(path) && seen.insert(path).second)
+            result.push_back(path);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+static std::vector<std::string> store_outputs(const build_job &job)
+{
+    // what the engine wrote, \include'd files' .aux in subdirectories too. a .synctex.gz is written under another
+    // name and renamed, so never shows up here, which is as well, it is full of paths into this checkout
+    std::set<std::string> names;
+    std::string prefix = normalise_path(job.outdir) + "/";
+    std::ifstream ifile(join_path(job.outdir, job.jobname + ".fls"));
+    std::string line, pwd = job.dir;
+
+    while(getline(ifile, line))
+    {
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if(line.substr(0, 4) == "PWD ")
+            pwd = line.substr(4);
+        else if(line.substr(0, 7) == "OUTPUT ")
+        {
+            std::string path = normalise_path(join_path(pwd, line.substr(7)));
+
+            if(path.compare(0, prefix.size(), prefix) == 0)
+                names.insert(path.substr(prefix.size()));
+        }
+    }
+
+    // and whatever else ended up next to them
+    std::vector<std::string> exts = {".fls", ".log"};
+    if(job.outext != "")
+        exts.push_back(job.outext);
+    for(auto &step:auxiliary_steps(job))
+        exts.insert(exts.end(), step.outputs.begin(), step.outputs.end());
+    for(auto &ext:exts)
+        names.insert(job.jobname + ext);
+
+    std::vector<std::string> result;
+    for(auto &name:names)
+    {
+        if(file_exists(join_path(job.outdir, name)))
+            result.push_back(name);
+    }
+    return result;
+}
+
+static std::vector<store_entry> read_manifest(const std::string &path)
+{
+    // result <hash>, then in <hash> <path> for each input, for every entry
+    std::ifstream ifile(path);
+    std::vector<store_entry> entries;
+    std::string line;
+    uint64_t h;
+
+    if(!getline(ifile, line) || line != manifest_header)
+        return entries;
+
+    while(getline(ifile, line))
+    {
+        if(line.compare(0, 7, "result ") == 0)
+        {
+            entries.push_back(store_entry());
+            entries.back().result = line.substr(7);
+        }
+        else if(line.compare(0, 3, "in ") == 0 && line.size() > 20 && !entries.empty() && parse_hex64(line.substr(3, 16), h))
+            entries.back().inputs.push_back(std::make_pair(h, line.substr(20)));
+        else
+            return std::vector<store_entry>(); // corrupt, as good as empty
+    }
+    return entries;
+}
+
+static bool write_manifest(const std::string &path, const std::vector<store_entry> &entries)
+{
+    std::string text = std::string(manifest_header) + "\n";
+
+    for(auto &entry:entries)
+    {
+        text += "result " + entry.result + "\n";
+        for(auto &input:entry.inputs)
+            text += "in " + hex64(input.first) + " " + input.second + "\n";
+    }
+    return write_atomically(path, text);
+}
+
+static bool inputs_match(const build_job &job, const store_entry &entry, std::map<std::string, std::pair<bool, uint64_t> > &hashes)
+{
+    for(auto &input:entry.inputs)
+    {
+        std::string path = local_text(job, input.second);
+        auto found = hashes.find(path);
+
+        if(found == hashes.end())
+        {
+            uint64_t h = 0;
+            bool readable = hash_file(path, h);
+            found = hashes.insert(std::make_pair(path, std::make_pair(readable, h))).first;
+        }
+        if(!found->second.first || found->second.second != input.first)
+            return false;
+    }
+    return true;
+}
+
+static bool materialise(const build_job &job, const std::string &root, const std::string &result)
+{
+    std::string path = join_path(root, "results/" + result);
+    std::ifstream ifile(path);
+    std::vector<std::pair<std::string, std::string> > files;
+    std::string line, contents;
+
+    if(!getline(ifile, line) || line != result_header)
+        return false;
+
+    // <object> <path under the output directory>, all read and checked before anything is written
+    while(getline(ifile, line))
+    {
+        std::string object = line.substr(0, 16), name = line.size() > 17 ? normalise_path(line.substr(17)) : "";
+
+        if(name == "" || name[0] == '/' || name.compare(0, 2, "..") == 0)
+            return false; // not somewhere a build could have written
+        if(!read_whole_file(join_path(root, "objects/" + object), contents) || hex64(hash_string(contents)) != object)
+            return false; // evicted, or only half copied to a shared store
+
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".fls") == 0)
+            contents = local_text(job, contents);
+        files.push_back(std::make_pair(name, contents));
+    }
+
+    for(auto &file:files)
+    {
+        std::string target = join_path(job.outdir, file.first);
+
+        make_directories(parent_directory(target));
+        if(!write_atomically(target, file.second))
+            return false;
+    }
+
+    utimensat(AT_FDCWD, path.c_str(), NULL, 0); // the most recently used now
+    return true;
+}
+
+bool store_fetch(const build_job &job)
+{
+    profile_scope lookup("look up build store", "cache");
+    std::string key = hex64(direct_key(job));
+    std::map<std::string, std::pair<bool, uint64_t> > hashes; // each file hashed once, however many entries list it
+
+    for(auto &root:store_roots())
+    {
+        std::vector<store_entry> entries = read_manifest(join_path(root, "manifests/" + key));
+
+        // the newest first, it's the likeliest to match
+        for(auto entry = entries.rbegin(); entry != entries.rend(); entry++)
+        {
+            if(inputs_match(job, *entry, hashes) && materialise(job, root, entry->result))
+            {
+                std::cout << "Found an identical build in '" << root << "', copied its output rather than compiling\n" << std::endl;
+                lookup.arg("hit", root);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static uint64_t walk_store(const std::string &dir, std::map<std::string, time_t> &files)
+{
+    // name -> mtime of everything in one of the store's directories, returns their total size
+    DIR *d = opendir(dir.c_str());
+    uint64_t total = 0;
+    struct stat st;
+
+    if(!d)
+        return 0;
+
+    struct dirent *entry;
+    while((entry = readdir(d)) != NULL)
+    {
+        std::string name = entry->d_name;
+
+        if(name[0] == '.' || name.find(".tmp") != std::string::npos || stat(join_path(dir, name).c_str(), &st) != 0)
+            continue;
+        files[name] = st.st_mtime;
+        total += st.st_size;
+    }
+    closedir(d);
+    return total;
+}
+
+static void evict_store(const std::string &root)
+{
+    std::string stamp = join_path(root, ".evicted");
+    time_t now = time(NULL);
+    struct stat st;
+
+    if(stat(stamp.c_str(), &st) == 0 && st.st_mtime <= now && now - st.st_mtime < evict_interval)
+        return;
+
+    int stampfd = open(stamp.c_str(), O_WRONLY | O_CREAT, 0644);
+    if(stampfd >= 0)
+    {
+        futimens(stampfd, NULL);
+        close(stampfd);
+    }
+
+    std::map<std::string, time_t> objects, results, manifests;
+    uint64_t limit = (uint64_t)store_limit_mb * 1024 * 1024;
+
+    if(walk_store(join_path(root, "objects"), objects) <= limit)
+        return;
+
+    // saves take the same lock, so no object is written without its result being there by the time it is released
+    int lockfd = open(join_path(root, "lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if(lockfd >= 0)
+        flock(lockfd, LOCK_EX);
+
+    walk_store(join_path(root, "results"), results);
+
+    std::vector<std::pair<time_t, std::string> > newest;
+    for(auto &result:results)
+        newest.push_back(std::make_pair(result.second, result.first));
+    std::sort(newest.rbegin(), newest.rend());
+
+    // keep the most recently used results for as long as the objects they need fit
+    std::set<std::string> kept;
+    uint64_t kept_size = 0;
+    size_t removed = 0;
+
+    for(auto &result:newest)
+    {
+        std::string path = join_path(root, "results/" + result.second), line;
+        std::ifstream ifile(path);
+        std::vector<std::string> needed;
+        uint64_t size = 0;
+
+        getline(ifile, line);
+        while(getline(ifile, line))
+        {
+            std::string object = line.substr(0, 16);
+
+            if(!kept.count(object) && std::find(needed.begin(), needed.end(), object) == needed.end())
+            {
+                needed.push_back(object);
+                if(stat(join_path(root, "objects/" + object).c_str(), &st) == 0)
+                    size += st.st_size;
+            }
+        }
+
+        if(removed > 0 || kept_size + size > limit)
+        {
+            remove(path.c_str());
+            removed++;
+            continue;
+        }
+        kept.insert(needed.begin(), needed.end());
+        kept_size += size;
+    }
+
+    for(auto &object:objects)
+    {
+        if(!kept.count(object.first))
+            remove(join_path(root, "objects/" + object.first).c_str());
+    }
+
+    // and forget the entries that point at the results just removed
+    walk_store(join_path(root, "manifests"), manifests);
+    for(auto &manifest:manifests)
+    {
+        std::string path = join_path(root, "manifests/" + manifest.first);
+        std::vector<store_entry> entries = read_manifest(path), remaining;
+
+        for(auto &entry:entries)
+        {
+            if(file_exists(join_path(root, "results/" + entry.result)))
+                remaining.push_back(entry);
+        }
+
+        if(remaining.empty())
+            remove(path.c_str());
+        else if(remaining.size() != entries.size())
+            write_manifest(path, remaining);
+    }
+
+    if(lockfd >= 0)
+        close(lockfd);
+
+    if(removed > 0)
+        std::cout << "Removed the " << removed << " least recently used " << (removed == 1 ? "build" : "builds") << " from '" << root
+                  << "', to keep under the --store-limit of " << store_limit_mb << " MB" << std::endl;
+}
+
+static bool save_into(const std::string &root, const std::string &key, const store_entry &entry,
+                      const std::vector<std::pair<std::string, std::string> > &files)
+{
+    if(!make_directories(join_path(root, "objects")) || !make_directories(join_path(root, "results"))
+       || !make_directories(join_path(root, "manifests")))
+        return false;
+
+    // eviction takes turns with this, so it never sees an object before the result that needs it
+    int lockfd = open(join_path(root, "lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if(lockfd >= 0)
+        flock(lockfd, LOCK_EX);
+
+    std::string listing = std::string(result_header) + "\n";
+    bool ok = true;
+
+    for(auto &file:files)
+    {
+        std::string object = hex64(hash_string(file.second)), path = join_path(root, "objects/" + object);
+
+        if(!file_exists(path))
+            ok = ok && write_atomically(path, file.second);
+        listing += object + " " + file.first + "\n";
+    }
+    ok = ok && write_atomically(join_path(root, "results/" + entry.result), listing);
+
+    if(ok)
+    {
+        std::string path = join_path(root, "manifests/" + key);
+        std::vector<store_entry> entries = read_manifest(path);
+
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [&entry](const store_entry &e) { return e.result == entry.result; }), entries.end());
+        entries.push_back(entry);
+        if(entries.size() > max_manifest_entries)
+            entries.erase(entries.begin(), entries.end() - max_manifest_entries);
+
+        ok = write_manifest(path, entries);
+    }
+
+    if(lockfd >= 0)
+        close(lockfd);
+    return ok;
+}
+
+void store_save(const build_job &job)
+{
+    profile_scope saving("save to build store", "cache");
+
+    if(!file_exists(join_path(job.outdir, job.jobname + ".fls")))
+    {
+        // without the .fls there's no knowing what another build would have to match
+        std::cout << "Warning: no recorder output found, not saving this build to the store" << std::endl;
+        return;
+    }
+
+    uint64_t key = direct_key(job), result = key, h;
+    store_entry entry;
+
+    for(auto &input:store_inputs(job))
+    {
+        if(!hash_file(input, h))
+            return; // gone since the engine read it, so what was built from it can't be checked against anything
+
+        entry.inputs.push_back(std::make_pair(h, portable_text(job, input)));
+        result = hash_string(hex64(h) + " " + entry.inputs.back().second + "\n", result);
+    }
+    entry.result = hex64(result);
+
+    // read once for every store, with this checkout's paths taken out of the .fls
+    std::vector<std::pair<std::string, std::string> > files;
+    std::string contents;
+
+    for(auto &name:store_outputs(job))
+    {
+        if(!read_whole_file(join_path(job.outdir, name), contents))
+            return;
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".fls") == 0)
+            contents = portable_text(job, contents);
+        files.push_back(std::make_pair(name, contents));
+    }
+
+    for(auto &root:store_roots())
+    {
+        if(!save_into(root, hex64(key), entry, files))
+            std::cout << "Warning: could not save this build to the store in '" << root << "'" << std::endl;
+    }
+
+    // a shared store is left to whoever looks after it
+    if(store_root != "")
+        evict_store(store_root);
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "texbuild.h"
+
+#include <string>
+
+#ifdef SYSTEM_IS_LINUX
+// --store: the results of successful builds kept by what went into them, so an identical build anywhere else (another
+// checkout, another user, a CI runner) can copy them out rather than run the engine. each store directory has
+//   manifests/<key>  the command and master contents hash to this, lists the input sets seen with it and their results
+//   results/<hash>   the files one build left in its output directory, by object
+//   objects/<hash>   the files themselves, by contents
+// paths inside the source and output directories are kept relative, so the checkout can be anywhere
+
+// looks the job up in the local then the shared store, and on a hit writes what the build would have to job.outdir
+bool store_fetch(const build_job &job);
+
+// records a successful build in every store in use, then evicts from the local one if it is over the limit
+void store_save(const build_job &job);
+#endif
+
+#endif
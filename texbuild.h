@@ -0,0 +1,80 @@
+#ifndef TEXBUILD_H
+#define TEXBUILD_H
+
+#ifdef __linux__
+    #define SYSTEM_IS_LINUX // uncomment if using on a Linux system
+    #include <unistd.h>
+    #include <sys/types.h>
+    #include <pwd.h>
+#elif defined(_WIN32)
+    #define SYSTEM_IS_WINDOWS // uncomment if using on a Windows system
+    #include <windows.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// everything needed to build one (master) file, filled in by parse_file()
+struct build_job
+{
+    std::string dir;        // directory containing the file, without the trailing slash
+    std::string file;       // name part of the file, e.g. main.tex
+    std::string texpath;    // full path to the file
+    std::string jobname;    // name part without the extension, e.g. main
+    std::string outdir;     // where the engine puts the .aux, .log, .fls and output files
+    std::string publishdir; // where the output is copied once built, when outdir only holds the intermediate files
+
+    std::string engine, options, bibengine, biboptions, outext, openwith, outopts;
+    std::string index, glossary, nomencl; // programs for the other auxiliary steps, empty if the document doesn't use them
+
+    // the assembled command strings, any of which may be empty
+    std::string compcall, bibcall, openpdfcall;
+    std::vector<std::string> comp_argv, bib_argv, open_argv; // the same commands split into arguments
+    std::vector<std::string> index_argv, glossary_argv, nomencl_argv; // run next to the .aux, like the bib engine
+
+    int max_passes;         // the engine is run at most this many times
+    bool focus;             // focus=yes, build just the \include'd file a build was started from
+
+    // variants=, name and TeX code for each, built in place of the master itself
+    std::vector<std::pair<std::string, std::string> > variants;
+    std::string variant;    // which of them this job builds, empty for the master as it is
+    std::string prelude;    // that variant's TeX, run before the master is \input
+
+    std::vector<std::string> preamble_inputs; // local files baked into the precompiled preamble, if one is used
+    std::string figuredir;  // figures converted to PDF ahead of the engine, which finds them through TEXINPUTS
+};
+
+extern std::string config_path;
+extern const char *version;
+extern std::string dont_use_specvalue;
+
+extern bool refresh_viewer;
+extern bool incremental_build;
+extern bool force_build;
+extern std::string output_root;
+extern std::string aux_root;
+extern std::string store_root;
+extern std::string shared_store;
+extern long store_limit_mb;
+extern long aux_root_limit_mb;
+extern bool watch_mode;
+extern int watch_debounce_ms;
+extern int process_timeout;
+extern bool precompile_preamble;
+extern bool draft_passes;
+extern bool preconvert_figures;
+extern bool preflight_build;
+extern bool focus_build;
+extern bool profile_build;
+extern std::string profile_file;
+
+bool file_exists(const std::string name);
+std::vector<std::string> explode(std::string s, char c);
+void sanitise_path(std::string &path);
+
+int resolve_job(std::string dir, std::string file, build_job &job); // dir must end in a slash
+int compile_document(const build_job &job, bool *skipped = NULL); // returns the engine's exit status
+int execute_command(const build_job &job);
+
+#endif
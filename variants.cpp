@@ -0,0 +1,210 @@
+#include "variants.h"
+#include "auxdir.h"
+#include "process.h"
+#include "fileutil.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cerrno>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+
+// what a variant's child exits with, as in batch mode
+static const int child_built = 0, child_failed = 1, child_up_to_date = 2;
+
+static void rename_arguments(std::vector<std::string> &argv, const build_job &job, const build_job &variant)
+{
+    // the auxiliary programs are given the job name, or files named after it, and some the output directory
+    for(auto &arg:argv)
+    {
+        size_t equals = arg.find("-output-directory=");
+
+        if(equals != std::string::npos)
+            arg = arg.substr(0, equals + 18) + variant.outdir;
+        else if(arg == job.jobname)
+            arg = variant.jobname;
+        else if(arg.compare(0, job.jobname.size() + 1, job.jobname + ".") == 0)
+            arg = variant.jobname + arg.substr(job.jobname.size());
+    }
+}
+
+build_job variant_job(const build_job &job, size_t i)
+{
+    build_job variant = job;
+
+    variant.variants.clear();
+    variant.variant = job.variants[i].first;
+    variant.prelude = job.variants[i].second;
+    variant.jobname = job.jobname + "-" + variant.variant;
+    variant.outdir = join_path(job.outdir, ".variants/" + variant.variant); // hidden, so nothing mirrors or scans it
+    variant.publishdir = job.publishdir != "" ? job.publishdir : job.outdir;
+
+    // run on the wrapper, named after the variant, the master's name is the last argument
+    if(!variant.comp_argv.empty())
+    {
+        std::string wrapper = join_path(variant.outdir, variant.jobname + ".variant.tex");
+
+        variant.comp_argv.back() = "-jobname=" + variant.jobname;
+        rename_arguments(variant.comp_argv, job, variant);
+        variant.comp_argv.push_back(wrapper);
+        variant.compcall = join_arguments(variant.comp_argv);
+    }
+
+    for(auto argv:{&variant.bib_argv, &variant.index_argv, &variant.glossary_argv, &variant.nomencl_argv})
+        rename_arguments(*argv, job, variant);
+    if(!variant.bib_argv.empty())
+        variant.bibcall = join_arguments(variant.bib_argv);
+
+    return variant;
+}
+
+static bool write_wrapper(const build_job &variant)
+{
+    // left alone when it hasn't changed, it is one of the files the build reads
+    std::string path = variant.comp_argv.back(), text = variant.prelude + "\\input{" + variant.file + "}\n", old;
+
+    if(read_whole_file(path, old) && old == text)
+        return true;
+
+    std::ofstream ofile(path);
+    ofile << text; // the engine runs in the master's directory
+    ofile.close();
+    return !ofile.fail();
+}
+
+// one variant being built
+struct variant_entry
+{
+    build_job job;
+    std::string log;
+    std::chrono::steady_clock::time_point start;
+};
+
+static pid_t start_variant(variant_entry &entry)
+{
+    entry.log = join_path(entry.job.outdir, entry.job.jobname + ".texbuild.log");
+    entry.start = std::chrono::steady_clock::now();
+
+    std::cout.flush(); // otherwise the child prints whatever is still buffered a second time
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        int fd = open(entry.log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        std::cout << "This is TeXbuild v" << version << ", building the '" << entry.job.variant << "' variant of '"
+                  << entry.job.texpath << "'\n" << std::endl;
+
+        bool skipped;
+        int rc = compile_document(entry.job, &skipped);
+
+        std::cout.flush();
+        _exit(rc != 0 ? child_failed : skipped ? child_up_to_date : child_built);
+    }
+    return pid;
+}
+
+int build_variants(const build_job &job, bool *skipped)
+{
+    std::vector<variant_entry> entries;
+
+    if(skipped)
+        *skipped = false;
+
+    // with --auxdir the variants live inside the master's directory, which mustn't be evicted from under them
+    int auxfd = -1;
+    if(job.publishdir != "" && (auxfd = claim_aux_dir(job)) < 0)
+    {
+        std::cout << "\nError: could not use '" << job.outdir << "' for the intermediate files\n" << std::endl;
+        return 1;
+    }
+
+    for(size_t i = 0; i < job.variants.size(); i++)
+    {
+        variant_entry entry;
+        entry.job = variant_job(job, i);
+
+        if(!make_directories(entry.job.outdir) || (!entry.job.comp_argv.empty() && !write_wrapper(entry.job)))
+        {
+            std::cout << "\nError: could not set up '" << entry.job.outdir << "' for the '" << entry.job.variant << "' variant\n" << std::endl;
+            release_aux_dir(auxfd);
+            return 1;
+        }
+        entries.push_back(entry);
+    }
+
+    std::cout << "Building " << entries.size() << (entries.size() == 1 ? " variant" : " variants") << " of '"
+              << job.texpath << "' at once...\n" << std::endl;
+
+    // there are only ever a few, and the point is for them to take no longer than the slowest one
+    std::map<pid_t, size_t> running;
+    int failed = 0, up_to_date = 0;
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        pid_t pid = start_variant(entries[i]);
+
+        if(pid < 0)
+        {
+            std::cout << "Error: fork() failed for the '" << entries[i].job.variant << "' variant" << std::endl;
+            failed++;
+        }
+        else
+            running[pid] = i;
+    }
+
+    while(!running.empty())
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if(pid < 0 && errno != EINTR)
+            break;
+        if(pid < 0 || running.find(pid) == running.end())
+            continue;
+
+        variant_entry &entry = entries[running[pid]];
+        running.erase(pid);
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - entry.start).count();
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : child_failed;
+        std::string result = code == child_built ? "built" : code == child_up_to_date ? "up to date" : "FAILED";
+
+        if(code == child_up_to_date)
+            up_to_date++;
+        else if(code != child_built)
+            failed++;
+
+        std::cout << std::left << std::setw(11) << result << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(7) << elapsed << "s  " << entry.job.variant << " (" << entry.job.jobname << job.outext << ")" << std::endl;
+
+        if(code != child_built && code != child_up_to_date)
+        {
+            std::string output;
+            read_whole_file(entry.log, output);
+            std::cout << "\n--- " << entry.job.variant << " (see '" << entry.log << "') ---\n" << output << std::endl;
+        }
+    }
+
+    release_aux_dir(auxfd);
+
+    if(skipped)
+        *skipped = up_to_date == (int)entries.size();
+    return failed == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef VARIANTS_H
+#define VARIANTS_H
+
+#include "texbuild.h"
+
+#ifdef SYSTEM_IS_LINUX
+// variants=: one master built several ways at once, e.g. slides, handout and notes. each variant is a job of its own,
+// named <job>-<variant> with its intermediate files in <outdir>/.variants/<variant>, and compiled through a wrapper
+// that runs the variant's TeX and then \input's the master. its output goes where the master's would
+
+build_job variant_job(const build_job &job, size_t i); // the job for job.variants[i]
+
+// builds every variant at the same time, each with its output going to a log until it has finished
+// returns 0 if they all built, skipped is set if they were all up to date already
+int build_variants(const build_job &job, bool *skipped);
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+#include "viewer.h"
+#include "process.h"
+#include "fileutil.h"
+#include "profile.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+
+#include <fcntl.h>
+#include <sys/file.h>
+
+typedef std::map<std::string, pid_t> viewer_registry; // output file -> viewer pid
+
+static bool process_shows(pid_t pid, const std::string &output)
+{
+    // the pid may have been reused by something else since, so check it still has the output on its command line
+    std::string cmdline;
+
+    if(pid <= 0 || !read_whole_file("/proc/" + std::to_string(pid) + "/cmdline", cmdline))
+        return false;
+
+    // the arguments are NUL-terminated, and explode() would trip over any quotes in them
+    for(size_t start = 0, end; start < cmdline.size(); start = end + 1)
+    {
+        end = cmdline.find('\0', start);
+        if(end == std::string::npos)
+            end = cmdline.size();
+        if(cmdline.compare(start, end - start, output) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool process_alive(pid_t pid)
+{
+    // a viewer that failed to start lingers as a zombie until init gets round to it, which kill(pid, 0) can't tell apart
+    std::string stat;
+
+    if(!read_whole_file("/proc/" + std::to_string(pid) + "/stat", stat))
+        return false;
+
+    size_t state = stat.rfind(')'); // the name in brackets may itself contain spaces or brackets
+    return state != std::string::npos && state + 2 < stat.size() && stat[state + 2] != 'Z';
+}
+
+static void load_registry(viewer_registry &registry)
+{
+    // <pid> <output file>
+    std::ifstream ifile(config_path + "viewers");
+    std::string line;
+
+    while(getline(ifile, line))
+    {
+        size_t spacepos = line.find(' ');
+
+        if(spacepos != std::string::npos)
+            registry[line.substr(spacepos + 1)] = atoi(line.substr(0, spacepos).c_str());
+    }
+}
+
+pid_t registered_viewer(const std::string &output)
+{
+    viewer_registry registry;
+    load_registry(registry);
+
+    auto entry = registry.find(output);
+
+    if(entry == registry.end() || !process_shows(entry->second, output))
+        return -1;
+    return entry->second;
+}
+
+void register_viewer(const std::string &output, pid_t pid)
+{
+    viewer_registry registry;
+
+    make_directories(config_path);
+
+    // several texbuilds may be opening viewers at once
+    int lockfd = open((config_path + "viewers.lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if(lockfd >= 0)
+        flock(lockfd, LOCK_EX);
+
+    load_registry(registry);
+    registry[output] = pid;
+
+    std::string path = config_path + "viewers";
+    std::ofstream ofile(path + ".tmp");
+
+    for(auto &entry:registry)
+    {
+        // forget about viewers that have been closed while we're here
+        if(process_shows(entry.second, entry.first))
+            ofile << entry.second << " " << entry.first << "\n";
+    }
+    ofile.close();
+
+    if(!ofile || rename((path + ".tmp").c_str(), path.c_str()) != 0)
+        std::cout << "Warning: could not write the viewer list '" << path << "'" << std::endl;
+
+    if(lockfd >= 0)
+        close(lockfd);
+}
+
+void open_viewer(const build_job &job)
+{
+    profile_scope scope("viewer", "viewer");
+    std::string output = job.open_argv[1];
+    pid_t pid = registered_viewer(output);
+
+    if(pid > 0)
+    {
+        if(refresh_viewer)
+            kill(pid, SIGHUP); // okular and friends reload the file on SIGHUP
+        return;
+    }
+
+    pid = spawn_detached(job.open_argv);
+
+    if(pid < 0)
+    {
+        std::cout << "\nError: failed to open file\n" << std::endl;
+        return;
+    }
+
+    // give exec() a moment, until then /proc/<pid>/cmdline is still texbuild's
+    for(int i = 0; i < 50 && !process_shows(pid, output) && process_alive(pid); i++)
+        usleep(2000);
+
+    register_viewer(output, pid);
+}
+
+#endif
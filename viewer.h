@@ -0,0 +1,18 @@
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#include "texbuild.h"
+
+#include <string>
+
+#ifdef SYSTEM_IS_LINUX
+// opens the output in the viewer, unless the viewer texbuild opened last time is still showing it,
+// in which case it is sent SIGHUP to reload if refresh_viewer is set
+void open_viewer(const build_job &job);
+
+// the viewer pids texbuild has started, one per output file, in config_path/viewers
+pid_t registered_viewer(const std::string &output); // -1 if there isn't one, or it has since closed
+void register_viewer(const std::string &output, pid_t pid);
+#endif
+
+#endif
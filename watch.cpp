@@ -0,0 +1,204 @@
+#include "watch.h"
+#include "cache.h"
+#include "depgraph.h"
+#include "fileutil.h"
+#include "viewer.h"
+
+#ifdef SYSTEM_IS_LINUX
+
+#include <iostream>
+#include <chrono>
+#include <map>
+#include <set>
+#include <cerrno>
+#include <csignal>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+
+typedef std::chrono::steady_clock watch_clock;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int)
+{
+    interrupted = 1;
+}
+
+static std::set<std::string> watched_files(const build_job &job)
+{
+    // what the scanner can see in the source, plus whatever the engine actually read last time
+    std::set<std::string> files;
+    std::string outprefix = join_path(job.outdir, job.jobname + ".");
+
+    files.insert(job.texpath);
+    for(auto &dep:scan_dependencies(job.texpath))
+        files.insert(dep.path);
+    for(auto &input:read_recorded_inputs(job))
+    {
+        // the .bbl, .toc etc. are written during the build, watching them would rebuild forever
+        if(input.compare(0, outprefix.size(), outprefix) != 0)
+            files.insert(normalise_path(input));
+    }
+    return files;
+}
+
+static void watch_directories(int fd, const std::set<std::string> &files, std::map<int, std::string> &dirs)
+{
+    // editors often save by writing a new file and renaming it over the old one, which a watch on the file
+    // itself would miss, so watch the directories and pick out the interesting names
+    std::set<std::string> known;
+    for(auto &entry:dirs)
+        known.insert(entry.second);
+
+    for(auto &file:files)
+    {
+        std::string dir = parent_directory(file);
+
+        if(known.count(dir))
+            continue;
+
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+        if(wd >= 0)
+        {
+            dirs[wd] = dir;
+            known.insert(dir);
+        }
+    }
+}
+
+static pid_t start_build(const build_job &job)
+{
+    std::cout << "\n==============================================================================\n" << std::endl;
+    std::cout.flush();
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        // a process group of its own, so the engine can be stopped along with the shell that started it
+        setpgid(0, 0);
+        signal(SIGINT, SIG_IGN); // Ctrl+C is for the watcher, which stops the build itself
+        signal(SIGTERM, SIG_DFL);
+        std::cout.flush();
+        _exit(compile_document(job) == 0 ? 0 : 1);
+    }
+    if(pid > 0)
+        setpgid(pid, pid);
+    return pid;
+}
+
+static void stop_build(pid_t pid)
+{
+    killpg(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+int run_watch(const build_job &job)
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(fd < 0)
+    {
+        std::cout << "Error: inotify is not available, can't watch for changes" << std::endl;
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = on_interrupt;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    std::map<int, std::string> dirs; // watch descriptor -> directory
+    std::set<std::string> files = watched_files(job);
+    watch_directories(fd, files, dirs);
+
+    std::cout << "Watching " << files.size() << (files.size() == 1 ? " file" : " files") << " in "
+              << dirs.size() << (dirs.size() == 1 ? " directory" : " directories") << ", press Ctrl+C to stop" << std::endl;
+
+    pid_t child = -1;
+    bool pending = true; // start with a build, the output may be out of date already
+    watch_clock::time_point last_change = watch_clock::now() - std::chrono::milliseconds(watch_debounce_ms);
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while(!interrupted)
+    {
+        int quiet = std::chrono::duration_cast<std::chrono::milliseconds>(watch_clock::now() - last_change).count();
+
+        if(pending && quiet >= watch_debounce_ms)
+        {
+            // the burst of saves is over, anything still building is working from stale sources
+            if(child > 0)
+            {
+                std::cout << "\nSources changed during the build, restarting it..." << std::endl;
+                stop_build(child);
+            }
+            child = start_build(job);
+            pending = false;
+        }
+
+        int timeout = -1;
+        if(pending)
+            timeout = watch_debounce_ms - quiet;
+        else if(child > 0)
+            timeout = 100; // keep an eye on the build
+        if(pending && child > 0 && timeout > 100)
+            timeout = 100;
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if(poll(&pfd, 1, timeout < 0 ? -1 : timeout) > 0)
+        {
+            ssize_t len;
+            while((len = read(fd, buffer, sizeof buffer)) > 0)
+            {
+                for(char *p = buffer; p < buffer + len; )
+                {
+                    struct inotify_event *event = (struct inotify_event *)p;
+                    p += sizeof(struct inotify_event) + event->len;
+
+                    if(event->len == 0 || dirs.find(event->wd) == dirs.end())
+                        continue;
+
+                    std::string path = join_path(dirs[event->wd], event->name);
+                    if(files.count(path))
+                    {
+                        if(!pending)
+                            std::cout << "\n'" << path << "' changed" << std::endl;
+                        pending = true;
+                        last_change = watch_clock::now();
+                    }
+                }
+            }
+        }
+
+        int status;
+        if(child > 0 && waitpid(child, &status, WNOHANG) == child)
+        {
+            child = -1;
+
+            if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            {
+                std::cout << "\nBuild finished, waiting for changes..." << std::endl;
+
+                if(job.openpdfcall != "")
+                    open_viewer(job); // only opens it if it isn't already
+            }
+            else
+                std::cout << "\nBuild failed, waiting for changes..." << std::endl;
+
+            // the document may have picked up new \input's, or the .fls may list more than the scanner found
+            files = watched_files(job);
+            watch_directories(fd, files, dirs);
+        }
+    }
+
+    if(child > 0)
+        stop_build(child);
+    close(fd);
+
+    std::cout << "\nStopped watching" << std::endl;
+    return 0;
+}
+
+#endif
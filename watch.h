@@ -0,0 +1,11 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "texbuild.h"
+
+#ifdef SYSTEM_IS_LINUX
+// rebuilds the document every time one of its sources is saved, until interrupted
+int run_watch(const build_job &job);
+#endif
+
+#endif